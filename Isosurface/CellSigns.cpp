@@ -0,0 +1,153 @@
+#include "CellSigns.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CELL_SIGNS_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CELL_SIGNS_SSE2 1
+#endif
+
+// What samples of type T are compared with. A sample is below the threshold
+// exactly when it is below the isovalue, so samples need not be widened to
+// double: floats are compared with the smallest float not below the isovalue,
+// integers with the smallest integer not below it, clamped to [lowest, max + 1].
+template<typename T>
+static auto threshold(double isovalue)
+{
+    if constexpr (std::is_same_v<T, double>) {
+        return isovalue;
+    } else if constexpr (std::is_same_v<T, float>) {
+        constexpr float inf = std::numeric_limits<float>::infinity();
+        constexpr float max = std::numeric_limits<float>::max();
+        if (isovalue != isovalue) {
+            return std::numeric_limits<float>::quiet_NaN();
+        }
+        if (isovalue > max) {
+            return inf;
+        }
+        if (isovalue < -max) {
+            return isovalue == -std::numeric_limits<double>::infinity() ? -inf : -max;
+        }
+        float t = float(isovalue);
+        if (double(t) < isovalue) {
+            t = std::nextafter(t, inf);
+        }
+        return t;
+    } else {
+        constexpr int lowest = std::numeric_limits<T>::lowest();
+        constexpr int max = std::numeric_limits<T>::max();
+        if (!(isovalue > lowest)) {
+            return lowest;
+        }
+        if (isovalue > max) {
+            return max + 1;
+        }
+        return int(std::ceil(isovalue));
+    }
+}
+
+template<typename T>
+void below_mask(const T* samples, int n, double isovalue, uint64_t* mask)
+{
+    std::fill(mask, mask + sign_words(n), 0);
+    const auto t = threshold<T>(isovalue);
+    int x = 0;
+
+    if constexpr (std::is_integral_v<T>) {
+        // Past the ends of T's range all samples are below, or none is
+        if (t > std::numeric_limits<T>::max()) {
+            for (; x + 64 <= n; x += 64) {
+                mask[x >> 6] = ~uint64_t(0);
+            }
+            if (x < n) {
+                mask[x >> 6] = (uint64_t(1) << (n - x)) - 1;
+            }
+            return;
+        }
+        if (t <= std::numeric_limits<T>::lowest()) {
+            return;
+        }
+    }
+
+    // Lanes per step divide 64, so a step's bits never straddle two words
+#if defined(CELL_SIGNS_AVX2)
+    if constexpr (std::is_same_v<T, double>) {
+        const __m256d vt = _mm256_set1_pd(t);
+        for (; x + 4 <= n; x += 4) {
+            const int bits = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(samples + x), vt, _CMP_LT_OQ));
+            mask[x >> 6] |= uint64_t(bits) << (x & 63);
+        }
+    } else if constexpr (std::is_same_v<T, float>) {
+        const __m256 vt = _mm256_set1_ps(t);
+        for (; x + 8 <= n; x += 8) {
+            const int bits = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(samples + x), vt, _CMP_LT_OQ));
+            mask[x >> 6] |= uint64_t(bits) << (x & 63);
+        }
+    } else if constexpr (std::is_same_v<T, short>) {
+        const __m256i vt = _mm256_set1_epi16(short(t));
+        for (; x + 32 <= n; x += 32) {
+            const __m256i a = _mm256_cmpgt_epi16(vt, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + x)));
+            const __m256i b = _mm256_cmpgt_epi16(vt, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + x + 16)));
+            // packs works within 128 bit lanes, so its quarters come out as a0 b0 a1 b1
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+            mask[x >> 6] |= uint64_t(uint32_t(_mm256_movemask_epi8(packed))) << (x & 63);
+        }
+    } else if constexpr (std::is_same_v<T, unsigned char>) {
+        // v < t for unsigned bytes is min(v, t - 1) == v
+        const __m256i vt = _mm256_set1_epi8(char(t - 1));
+        for (; x + 32 <= n; x += 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + x));
+            const __m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(v, vt), v);
+            mask[x >> 6] |= uint64_t(uint32_t(_mm256_movemask_epi8(below))) << (x & 63);
+        }
+    }
+#elif defined(CELL_SIGNS_SSE2)
+    if constexpr (std::is_same_v<T, double>) {
+        const __m128d vt = _mm_set1_pd(t);
+        for (; x + 2 <= n; x += 2) {
+            const int bits = _mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(samples + x), vt));
+            mask[x >> 6] |= uint64_t(bits) << (x & 63);
+        }
+    } else if constexpr (std::is_same_v<T, float>) {
+        const __m128 vt = _mm_set1_ps(t);
+        for (; x + 4 <= n; x += 4) {
+            const int bits = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(samples + x), vt));
+            mask[x >> 6] |= uint64_t(bits) << (x & 63);
+        }
+    } else if constexpr (std::is_same_v<T, short>) {
+        const __m128i vt = _mm_set1_epi16(short(t));
+        for (; x + 16 <= n; x += 16) {
+            const __m128i a = _mm_cmplt_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + x)), vt);
+            const __m128i b = _mm_cmplt_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + x + 8)), vt);
+            const int bits = _mm_movemask_epi8(_mm_packs_epi16(a, b));
+            mask[x >> 6] |= uint64_t(bits) << (x & 63);
+        }
+    } else if constexpr (std::is_same_v<T, unsigned char>) {
+        // v < t for unsigned bytes is min(v, t - 1) == v
+        const __m128i vt = _mm_set1_epi8(char(t - 1));
+        for (; x + 16 <= n; x += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + x));
+            const int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, vt), v));
+            mask[x >> 6] |= uint64_t(bits) << (x & 63);
+        }
+    }
+#endif
+
+    for (; x < n; x++) {
+        mask[x >> 6] |= uint64_t(samples[x] < t) << (x & 63);
+    }
+}
+
+#define INSTANTIATE_CELL_SIGNS(T) \
+    template void below_mask<T>(const T*, int, double, uint64_t*);
+
+INSTANTIATE_CELL_SIGNS(double)
+INSTANTIATE_CELL_SIGNS(float)
+INSTANTIATE_CELL_SIGNS(short)
+INSTANTIATE_CELL_SIGNS(unsigned char)
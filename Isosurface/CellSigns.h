@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Sign masks of rows of samples, for finding the case indices (see EDGE_TBL)
+// of a row of marching cubes cells 64 cells at a time. Bit x of a row's mask
+// is set if sample x is below the isovalue, the test every corner of a case
+// index gets.
+
+// Words in the mask of a row of n samples
+inline int sign_words(int n)
+{
+    return (n + 63) / 64;
+}
+
+// Writes the mask of samples[0, n) to mask[0, sign_words(n)), with the bits
+// past n clear. Compares a vector of samples at a time with AVX2 or SSE2,
+// whichever the build targets, and one at a time otherwise.
+template<typename T>
+void below_mask(const T* samples, int n, double isovalue, uint64_t* mask);
+
+inline int lowest_bit(uint64_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return int(i);
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// Calls visit(x, cube_index) for each cell x in [0, cells) of a row of cells
+// that has corners on both sides of the isovalue. `rows` are the masks of the
+// rows of corners (y, z), (y + 1, z), (y, z + 1) and (y + 1, z + 1), of
+// cells + 1 samples each. The cells all of whose corners are on one side are
+// told apart with a few word operations per 64 cells and never visited.
+template<typename Visit>
+inline void for_each_crossed_cell(const uint64_t* const (&rows)[4], int cells, Visit&& visit)
+{
+    const int words = sign_words(cells + 1);
+    for (int k = 0; k * 64 < cells; k++) {
+        // Bit b of low[r] is the corner of cell 64k + b on row r at x, of high[r] the one at x + 1
+        uint64_t low[4];
+        uint64_t high[4];
+        for (int r = 0; r < 4; r++) {
+            low[r] = rows[r][k];
+            high[r] = low[r] >> 1 | (k + 1 < words ? rows[r][k + 1] << 63 : 0);
+        }
+        const uint64_t all = low[0] & high[0] & low[1] & high[1] & low[2] & high[2] & low[3] & high[3];
+        const uint64_t any = low[0] | high[0] | low[1] | high[1] | low[2] | high[2] | low[3] | high[3];
+        uint64_t crossed = any & ~all;
+        if (cells - k * 64 < 64) {
+            crossed &= (uint64_t(1) << (cells - k * 64)) - 1;
+        }
+
+        while (crossed != 0) {
+            const int b = lowest_bit(crossed);
+            crossed &= crossed - 1;
+            const int cube_index = int(low[0] >> b & 1) | int(high[0] >> b & 1) << 1
+                    | int(high[1] >> b & 1) << 2 | int(low[1] >> b & 1) << 3
+                    | int(low[2] >> b & 1) << 4 | int(high[2] >> b & 1) << 5
+                    | int(high[3] >> b & 1) << 6 | int(low[3] >> b & 1) << 7;
+            visit(k * 64 + b, cube_index);
+        }
+    }
+}
@@ -0,0 +1,299 @@
+#include "IncrementalSurface.h"
+
+#include <Parallel.h>
+#include <algorithm>
+#include <stdexcept>
+
+static constexpr size_t BLOCK_CELLS = size_t(MINMAX_BLOCK) * MINMAX_BLOCK * MINMAX_BLOCK;
+
+// Room a block gets in the arrays, so it can grow a little before it moves.
+// Index ranges stay whole triangles.
+static size_t vertex_room(size_t count)
+{
+    return count + count / 4 + 4;
+}
+
+static size_t index_room(size_t count)
+{
+    return (count + count / 4) / 3 * 3 + 12;
+}
+
+// Sorts spans and joins the ones less than `gap` elements apart, so a patch is
+// a few larger uploads rather than one per block
+static void join_spans(std::vector<IncrementalSurface::Span>& spans, size_t gap)
+{
+    std::sort(spans.begin(), spans.end(), [](const auto& a, const auto& b) { return a.begin < b.begin; });
+    size_t joined = 0;
+    for (const IncrementalSurface::Span& span : spans) {
+        if (span.count == 0) {
+            continue;
+        }
+        if (joined > 0 && span.begin <= spans[joined - 1].begin + spans[joined - 1].count + gap) {
+            IncrementalSurface::Span& last = spans[joined - 1];
+            last.count = std::max(last.begin + last.count, span.begin + span.count) - last.begin;
+        } else {
+            spans[joined++] = span;
+        }
+    }
+    spans.resize(joined);
+}
+
+template<typename T>
+void IncrementalSurface::update(VTKField<T>& field, const GradientField& gradients, const MinMaxTree& ranges, double isovalue)
+{
+    m_relaid = false;
+    m_vertex_spans.clear();
+    m_index_spans.clear();
+    if (m_made && isovalue == m_isovalue) {
+        return;
+    }
+
+    const Dimension blocks = ranges.blocks();
+    const size_t layer_blocks = size_t(blocks.x) * blocks.y;
+    auto coordinates = [&](size_t key) {
+        return glm::ivec3(int(key % blocks.x), int(key / blocks.x % blocks.y), int(key / layer_blocks));
+    };
+
+    // The blocks with triangles before or after
+    std::vector<size_t> keys;
+    keys.reserve(m_blocks.size());
+    for (const auto& entry : m_blocks) {
+        keys.push_back(entry.first);
+    }
+    std::vector<glm::ivec2> active;
+    for (int bz = 0; bz < blocks.z; bz++) {
+        active.clear();
+        ranges.active_blocks(bz, isovalue, active);
+        for (const glm::ivec2& b : active) {
+            keys.push_back(b.x + size_t(b.y) * blocks.x + bz * layer_blocks);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    enum class Change : uint8_t { Move, Remake, Drop };
+    std::vector<Change> changes(keys.size());
+    std::vector<Remade> remade(keys.size());
+    const size_t parts = std::min(keys.size(), worker_count() * 4);
+    if (m_parts.size() < parts) {
+        m_parts.resize(parts);
+    }
+    parallel_for(parts, [&](size_t p) {
+        Part& part = m_parts[p];
+        part.mesh.vertices.clear();
+        part.mesh.normals.clear();
+        part.mesh.indices.clear();
+        part.vertex_edges.clear();
+
+        for (size_t k = keys.size() * p / parts; k < keys.size() * (p + 1) / parts; k++) {
+            const glm::ivec3 b = coordinates(keys[k]);
+            auto found = m_blocks.find(keys[k]);
+            Block* block = found == m_blocks.end() ? nullptr : &found->second;
+
+            if (!MinMaxTree::crosses(ranges.block(b), isovalue)) {
+                changes[k] = Change::Drop;
+            } else if (block && block->below < isovalue && isovalue <= block->above) {
+                // No sample of the block lies between the old and new isovalue
+                changes[k] = Change::Move;
+                MarchingCubes::move_vertices(m_mesh.vertices.data() + block->vertex_begin, m_mesh.normals.data() + block->vertex_begin,
+                        m_vertex_edges.data() + block->vertex_begin, block->vertex_count, field, gradients, isovalue);
+            } else {
+                changes[k] = Change::Remake;
+                uint8_t cases[BLOCK_CELLS];
+                Remade& r = remade[k];
+                r.key = keys[k];
+                r.part = p;
+                r.vertices.begin = part.mesh.vertices.size();
+                r.indices.begin = part.mesh.indices.size();
+                MarchingCubes::block_cases(part.scratch, field, b, isovalue, cases, r.below, r.above);
+                MarchingCubes::triangulate_block(part.mesh, part.vertex_edges, part.scratch, field, gradients, b, cases, isovalue);
+                r.vertices.count = part.mesh.vertices.size() - r.vertices.begin;
+                r.indices.count = part.mesh.indices.size() - r.indices.begin;
+            }
+        }
+    });
+
+    // Blocks that outgrew their ranges, or had none
+    std::vector<Remade> placed;
+    for (size_t k = 0; k < keys.size(); k++) {
+        auto found = m_blocks.find(keys[k]);
+        switch (changes[k]) {
+        case Change::Move:
+            m_vertex_spans.push_back({ found->second.vertex_begin, found->second.vertex_count });
+            break;
+        case Change::Drop:
+            if (found != m_blocks.end()) {
+                clear_indices(found->second);
+                m_free += found->second.vertex_capacity + found->second.index_capacity;
+                m_blocks.erase(found);
+            }
+            break;
+        case Change::Remake: {
+            Remade& r = remade[k];
+            if (found != m_blocks.end()
+                    && r.vertices.count <= found->second.vertex_capacity
+                    && r.indices.count <= found->second.index_capacity) {
+                found->second.below = r.below;
+                found->second.above = r.above;
+                write(found->second, r);
+            } else {
+                if (found != m_blocks.end()) {
+                    clear_indices(found->second);
+                    m_free += found->second.vertex_capacity + found->second.index_capacity;
+                    m_blocks.erase(found);
+                }
+                placed.push_back(r);
+            }
+            break;
+        }
+        }
+    }
+
+    // Blocks that left keep their ranges free until the arrays are laid out anew
+    if (!m_made || m_free > (m_vertex_end + m_index_end) / 2) {
+        relayout(placed);
+    } else {
+        append(placed);
+    }
+    m_made = true;
+    m_isovalue = isovalue;
+
+    if (m_relaid) {
+        m_vertex_spans.clear();
+        m_index_spans.clear();
+    } else {
+        join_spans(m_vertex_spans, 256);
+        join_spans(m_index_spans, 256);
+    }
+}
+
+void IncrementalSurface::clear()
+{
+    *this = IncrementalSurface();
+}
+
+void IncrementalSurface::clear_indices(const Block& block)
+{
+    std::fill_n(m_mesh.indices.begin() + block.index_begin, block.index_count, 0);
+    m_index_spans.push_back({ block.index_begin, block.index_count });
+}
+
+// Writes a block's vertices and triangles from its part into its ranges,
+// which fit them
+void IncrementalSurface::write(Block& block, const Remade& remade)
+{
+    const Part& part = m_parts[remade.part];
+    const size_t vertices = remade.vertices.count;
+    const size_t indices = remade.indices.count;
+    std::copy_n(part.mesh.vertices.begin() + remade.vertices.begin, vertices, m_mesh.vertices.begin() + block.vertex_begin);
+    std::copy_n(part.mesh.normals.begin() + remade.vertices.begin, vertices, m_mesh.normals.begin() + block.vertex_begin);
+    std::copy_n(part.vertex_edges.begin() + remade.vertices.begin, vertices, m_vertex_edges.begin() + block.vertex_begin);
+    const uint32_t from = uint32_t(remade.vertices.begin);
+    const uint32_t to = uint32_t(block.vertex_begin);
+    std::transform(part.mesh.indices.begin() + remade.indices.begin, part.mesh.indices.begin() + remade.indices.begin + indices,
+            m_mesh.indices.begin() + block.index_begin, [=](uint32_t index) { return index - from + to; });
+    // What is left of the old triangles becomes degenerate
+    if (indices < block.index_count) {
+        std::fill_n(m_mesh.indices.begin() + block.index_begin + indices, block.index_count - indices, 0);
+    }
+
+    m_vertex_spans.push_back({ block.vertex_begin, vertices });
+    m_index_spans.push_back({ block.index_begin, std::max(block.index_count, indices) });
+    block.vertex_count = vertices;
+    block.index_count = indices;
+}
+
+// Places blocks past the used part of the arrays, or lays them out anew if
+// they do not fit there
+void IncrementalSurface::append(const std::vector<Remade>& remade)
+{
+    size_t vertices = 0;
+    size_t indices = 0;
+    for (const Remade& r : remade) {
+        vertices += vertex_room(r.vertices.count);
+        indices += index_room(r.indices.count);
+    }
+    if (m_vertex_end + vertices > m_mesh.vertices.size() || m_index_end + indices > m_mesh.indices.size()) {
+        relayout(remade);
+        return;
+    }
+
+    for (const Remade& r : remade) {
+        Block& block = m_blocks[r.key];
+        block = Block();
+        block.vertex_begin = m_vertex_end;
+        block.vertex_capacity = vertex_room(r.vertices.count);
+        block.index_begin = m_index_end;
+        block.index_capacity = index_room(r.indices.count);
+        block.below = r.below;
+        block.above = r.above;
+        write(block, r);
+        m_vertex_end += block.vertex_capacity;
+        m_index_end += block.index_capacity;
+    }
+}
+
+// Packs all blocks into new arrays, each with fresh room, and leaves half as
+// much again past them for blocks that move later
+void IncrementalSurface::relayout(const std::vector<Remade>& remade)
+{
+    std::vector<size_t> keys;
+    keys.reserve(m_blocks.size());
+    size_t vertices = 0;
+    size_t indices = 0;
+    for (const auto& [key, block] : m_blocks) {
+        keys.push_back(key);
+        vertices += vertex_room(block.vertex_count);
+        indices += index_room(block.index_count);
+    }
+    std::sort(keys.begin(), keys.end());
+    for (const Remade& r : remade) {
+        vertices += vertex_room(r.vertices.count);
+        indices += index_room(r.indices.count);
+    }
+    if (vertices > UINT32_MAX) {
+        throw std::runtime_error("The isosurface has too many vertices for 32 bit indices.");
+    }
+
+    IndexedMesh mesh;
+    mesh.vertices.resize(vertices + vertices / 2);
+    mesh.normals.resize(vertices + vertices / 2);
+    mesh.indices.assign(indices + indices / 2 / 3 * 3, 0);
+    std::vector<uint64_t> vertex_edges(vertices + vertices / 2);
+
+    size_t vertex_end = 0;
+    size_t index_end = 0;
+    for (size_t key : keys) {
+        Block& block = m_blocks[key];
+        std::copy_n(m_mesh.vertices.begin() + block.vertex_begin, block.vertex_count, mesh.vertices.begin() + vertex_end);
+        std::copy_n(m_mesh.normals.begin() + block.vertex_begin, block.vertex_count, mesh.normals.begin() + vertex_end);
+        std::copy_n(m_vertex_edges.begin() + block.vertex_begin, block.vertex_count, vertex_edges.begin() + vertex_end);
+        const uint32_t old_begin = uint32_t(block.vertex_begin);
+        const uint32_t new_begin = uint32_t(vertex_end);
+        std::transform(m_mesh.indices.begin() + block.index_begin, m_mesh.indices.begin() + block.index_begin + block.index_count,
+                mesh.indices.begin() + index_end, [=](uint32_t index) { return index - old_begin + new_begin; });
+
+        block.vertex_begin = vertex_end;
+        block.vertex_capacity = vertex_room(block.vertex_count);
+        block.index_begin = index_end;
+        block.index_capacity = index_room(block.index_count);
+        vertex_end += block.vertex_capacity;
+        index_end += block.index_capacity;
+    }
+
+    m_mesh = std::move(mesh);
+    m_vertex_edges = std::move(vertex_edges);
+    m_vertex_end = vertex_end;
+    m_index_end = index_end;
+    m_free = 0;
+    append(remade);
+    m_relaid = true;
+}
+
+#define INSTANTIATE_INCREMENTAL_SURFACE(T) \
+    template void IncrementalSurface::update<T>(VTKField<T>&, const GradientField&, const MinMaxTree&, double);
+
+INSTANTIATE_INCREMENTAL_SURFACE(double)
+INSTANTIATE_INCREMENTAL_SURFACE(float)
+INSTANTIATE_INCREMENTAL_SURFACE(short)
+INSTANTIATE_INCREMENTAL_SURFACE(unsigned char)
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "MarchingCubes.h"
+#include "MinMaxTree.h"
+
+// An isosurface kept from one isovalue to the next, for dragging the isovalue.
+// It is made per level 0 block of a MinMaxTree, and each block has ranges of
+// its own in the mesh arrays, with some room to grow. When the isovalue moves:
+//
+//  - a block with no sample between the old and the new isovalue keeps the
+//    case indices of its cells, so its triangles stay as they are and only
+//    its vertices move along their edges,
+//  - any other block the isovalue crosses is triangulated anew, in its ranges
+//    if the result fits and at the end of the arrays otherwise,
+//  - a block the isovalue no longer crosses has its triangles cleared.
+//
+// Whether a sample lies in between is known from the samples nearest the
+// isovalue on either side, kept per block, without reading the samples again.
+// The parts of the arrays an update changed are listed, so GPU buffers holding
+// the mesh can be patched instead of uploaded again. Vertices are only shared
+// within a block.
+//
+// A surface belongs to one field; clear() it when the samples change.
+class IncrementalSurface {
+public:
+    // Elements [begin, begin + count) of one of the mesh arrays
+    struct Span {
+        size_t begin;
+        size_t count;
+    };
+
+    // Brings the surface to `isovalue`. `ranges` are built for `field`.
+    template<typename T>
+    void update(VTKField<T>& field, const GradientField& gradients, const MinMaxTree& ranges, double isovalue);
+
+    void clear();
+
+    // The mesh arrays, with room to grow. Unused triangles are degenerate, so
+    // the first index_count() indices can be drawn as they are.
+    const IndexedMesh& mesh() const { return m_mesh; }
+    size_t index_count() const { return m_index_end; }
+
+    // True if the last update laid the arrays out anew, so they need to be
+    // uploaded as a whole; otherwise only the spans below changed
+    bool relaid() const { return m_relaid; }
+    const std::vector<Span>& vertex_spans() const { return m_vertex_spans; }
+    const std::vector<Span>& index_spans() const { return m_index_spans; }
+
+private:
+    struct Block {
+        size_t vertex_begin = 0;
+        size_t vertex_count = 0;
+        size_t vertex_capacity = 0;
+        size_t index_begin = 0;
+        size_t index_count = 0;
+        size_t index_capacity = 0;
+        // The cells keep their cases for isovalues in (below, above], see
+        // MarchingCubes::block_cases
+        double below = 0.0;
+        double above = 0.0;
+    };
+
+    // Where an update triangulates blocks anew, a part for each run of blocks.
+    // Parts are kept from one update to the next, so once they have grown,
+    // triangulating a block takes no allocations.
+    struct Part {
+        IndexedMesh mesh;
+        std::vector<uint64_t> vertex_edges;
+        MarchingCubes::BlockScratch scratch;
+    };
+
+    // A block triangulated anew by an update, in its part's mesh, not yet
+    // placed in the arrays
+    struct Remade {
+        size_t key;
+        size_t part;
+        Span vertices;
+        Span indices;
+        double below;
+        double above;
+    };
+
+    void clear_indices(const Block& block);
+    void write(Block& block, const Remade& remade);
+    void append(const std::vector<Remade>& remade);
+    void relayout(const std::vector<Remade>& remade);
+
+    IndexedMesh m_mesh;
+    // Grid edge of each vertex, see MarchingCubes::move_vertices
+    std::vector<uint64_t> m_vertex_edges;
+    // End of the used part of the arrays
+    size_t m_vertex_end = 0;
+    size_t m_index_end = 0;
+    // Elements of the used part no block holds
+    size_t m_free = 0;
+
+    // Blocks with triangles, by their index in the MinMaxTree's level 0
+    std::unordered_map<size_t, Block> m_blocks;
+    bool m_made = false;
+    double m_isovalue = 0.0;
+    std::vector<Part> m_parts;
+
+    bool m_relaid = false;
+    std::vector<Span> m_vertex_spans;
+    std::vector<Span> m_index_spans;
+};
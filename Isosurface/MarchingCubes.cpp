@@ -1,115 +1,624 @@
 #include "MarchingCubes.h"
 #include "MarchingCubesLUT.h"
+#include "CellSigns.h"
+
+#include <Parallel.h>
+#include <SpscQueue.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 
 static constexpr int x_delta[8] = {0, 1, 1, 0, 0, 1, 1, 0};
 static constexpr int y_delta[8] = {0, 0, 1, 1, 0, 0, 1, 1};
 static constexpr int z_delta[8] = {0, 0, 0, 0, 1, 1, 1, 1};
 
+// Number of slabs `count` z-layers are split into for parallel work. A few per
+// worker, so slabs that cost more than others balance out.
+static size_t slab_count(int count)
+{
+    return std::min(size_t(std::max(count, 0)), worker_count() * 4);
+}
 
-std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> MarchingCubes::triangulate_field(VTKField<double>& field, double isovalue)
+// First layer of slab s of `slabs` over `count` layers
+static int slab_begin(size_t s, size_t slabs, int count)
 {
-    auto gradient = compute_gradient(field);
-    std::vector<glm::vec3> triangle_vertices;
-    std::vector<glm::vec3> vertex_normals;
+    return int(s * count / slabs);
+}
+
+// The corners of cell edge i (see EDGE_VERT_IDX) with the lower one first, and
+// the axis the edge runs along. Interpolating from the lower corner gives an
+// edge the same vertex whichever of its cells makes it.
+static constexpr int edge_start[12] = {0, 1, 3, 0, 4, 5, 7, 4, 0, 1, 2, 3};
+static constexpr int edge_end[12] = {1, 2, 2, 3, 5, 6, 6, 7, 4, 5, 6, 7};
+static constexpr int edge_axis[12] = {0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2};
+
+// A grid edge as one number: the x, y and z of its lower sample in bits 0-20,
+// 21-41 and 42-61, and its axis in bits 62-63
+static uint64_t edge_key(glm::ivec3 corner, int axis)
+{
+    return uint64_t(corner.x) | uint64_t(corner.y) << 21 | uint64_t(corner.z) << 42 | uint64_t(axis) << 62;
+}
+
+// Where the isovalue crosses the grid edge from sample c1 to c2, and the
+// normal there. A vertex moved along its edge comes out as if made anew.
+template<typename T>
+static void edge_vertex(VTKField<T>& field, const GradientField& gradients, glm::ivec3 c1, glm::ivec3 c2, double s1, double s2, double isovalue, glm::vec3& vertex, glm::vec3& normal)
+{
+    glm::vec3 p1 = glm::vec3(c1.x * field.spacing.x, c1.y * field.spacing.y, c1.z * field.spacing.z);
+    glm::vec3 p2 = glm::vec3(c2.x * field.spacing.x, c2.y * field.spacing.y, c2.z * field.spacing.z);
+    double t = (isovalue - s1) / (s2 - s1);
 
-    glm::ivec3 field_dim = glm::ivec3(field.dimension.x, field.dimension.y, field.dimension.z);
-    for (int x = 0; x < field_dim.x - 1; x++) {
-        for (int y = 0; y < field_dim.y - 1; y++) {
-            for (int z = 0; z < field_dim.z - 1; z++) {
-                triangulate_cell(triangle_vertices, vertex_normals, field, gradient, glm::ivec3(x, y, z), isovalue);
+    vertex = glm::mix(p1, p2, t);
+    normal = glm::normalize(glm::mix(gradients(c1.x, c1.y, c1.z), gradients(c2.x, c2.y, c2.z), t));
+}
+
+struct MarchingCubes::LayerEdges {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Vertices by the lower corner of their edge. The slots in use are noted,
+    // so clearing the table costs as much as the surface on it.
+    struct Table {
+        std::vector<uint32_t> vertices;
+        std::vector<size_t> used;
+
+        void clear()
+        {
+            for (size_t at : used) {
+                vertices[at] = NONE;
             }
+            used.clear();
         }
+    };
+
+    // Cells of the field's (x, y) with x >= origin.x and y >= origin.y
+    glm::ivec2 origin;
+    size_t row;
+    int layer = -1;
+    // The x and y edges of the layer's lower and upper slice, and the z edges
+    // between the two
+    Table slice_edges[2][2];
+    Table z_edges;
+    // If set, the grid edge (see edge_key) of each vertex made is appended here
+    std::vector<uint64_t>* vertex_edges = nullptr;
+
+    // Edges of the cells in a `samples` grid of samples starting at `origin`
+    explicit LayerEdges(Dimension samples, glm::ivec2 origin = glm::ivec2(0, 0))
+        : origin(origin), row(size_t(std::max(samples.x, 0)))
+    {
+        const size_t size = row * size_t(std::max(samples.y, 0));
+        for (auto& slice : slice_edges) {
+            slice[0].vertices.assign(size, NONE);
+            slice[1].vertices.assign(size, NONE);
+        }
+        z_edges.vertices.assign(size, NONE);
     }
 
-    return { triangle_vertices, vertex_normals };
+    // Starts over on the cells from another origin
+    void restart(glm::ivec2 new_origin)
+    {
+        origin = new_origin;
+        for (auto& slice : slice_edges) {
+            slice[0].clear();
+            slice[1].clear();
+        }
+        z_edges.clear();
+        layer = -1;
+    }
+
+    // The upper slice of a layer is the lower slice of the next one, so its
+    // vertices carry over when layers are triangulated in order
+    void begin_layer(int z)
+    {
+        if (z == layer + 1) {
+            std::swap(slice_edges[0], slice_edges[1]);
+        } else {
+            slice_edges[0][0].clear();
+            slice_edges[0][1].clear();
+        }
+        slice_edges[1][0].clear();
+        slice_edges[1][1].clear();
+        z_edges.clear();
+        layer = z;
+    }
+
+    // Vertex of edge i of the layer's cell (x, y). make() adds it to the mesh
+    // if no cell around the edge has yet.
+    template<typename Make>
+    uint32_t vertex(int i, int x, int y, Make&& make)
+    {
+        const int corner = edge_start[i];
+        const size_t at = size_t(x - origin.x + x_delta[corner]) + size_t(y - origin.y + y_delta[corner]) * row;
+        Table& table = edge_axis[i] == 2 ? z_edges : slice_edges[z_delta[corner]][edge_axis[i]];
+        if (table.vertices[at] == NONE) {
+            table.vertices[at] = make();
+            table.used.push_back(at);
+        }
+        return table.vertices[at];
+    }
+};
+
+// Sign masks (see CellSigns.h) of the samples around the cells (x, y) of
+// [begin.x, begin.x + cells.x) x [begin.y, begin.y + cells.y) in layer
+// begin.z. When the next layer of the same cells of the same field is
+// classified, the masks of the upper slice carry over as its lower slice.
+struct MarchingCubes::LayerSigns {
+    glm::ivec3 begin = glm::ivec3(0, 0, 0);
+    glm::ivec2 cells = glm::ivec2(-1, -1);
+    double isovalue = 0.0;
+    int words = 0;
+    // Row y of the lower (0) and upper (1) slice at y * words
+    std::vector<uint64_t> slices[2];
+
+    template<typename T>
+    void classify(const VTKField<T>& field, glm::ivec3 layer_begin, glm::ivec2 layer_cells, double layer_isovalue)
+    {
+        const bool next = layer_begin == begin + glm::ivec3(0, 0, 1) && layer_cells == cells && layer_isovalue == isovalue;
+        begin = layer_begin;
+        cells = layer_cells;
+        isovalue = layer_isovalue;
+        words = sign_words(cells.x + 1);
+
+        if (next) {
+            std::swap(slices[0], slices[1]);
+        }
+        for (int s = next ? 1 : 0; s < 2; s++) {
+            slices[s].resize(size_t(words) * (cells.y + 1));
+            for (int y = 0; y <= cells.y; y++) {
+                below_mask(&field(begin.x, begin.y + y, begin.z + s), cells.x + 1, isovalue, slices[s].data() + size_t(y) * words);
+            }
+        }
+    }
+
+    // Calls visit(x, cube_index) for the cells of row y the surface crosses,
+    // with x and y from begin
+    template<typename Visit>
+    void crossed_cells(int y, Visit&& visit) const
+    {
+        const uint64_t* rows[4] = {
+            slices[0].data() + size_t(y) * words,
+            slices[0].data() + size_t(y + 1) * words,
+            slices[1].data() + size_t(y) * words,
+            slices[1].data() + size_t(y + 1) * words
+        };
+        for_each_crossed_cell(rows, cells.x, visit);
+    }
+};
+
+MarchingCubes::BlockScratch::BlockScratch()
+    : m_edges(std::make_unique<LayerEdges>(Dimension { MINMAX_BLOCK + 1, MINMAX_BLOCK + 1, 1 })),
+      m_signs(std::make_unique<LayerSigns>())
+{
 }
 
-std::vector<std::vector<std::vector<glm::vec3>>> MarchingCubes::compute_gradient(VTKField<double>& field)
+MarchingCubes::BlockScratch::BlockScratch(BlockScratch&&) noexcept = default;
+MarchingCubes::BlockScratch& MarchingCubes::BlockScratch::operator=(BlockScratch&&) noexcept = default;
+MarchingCubes::BlockScratch::~BlockScratch() = default;
+
+// Joins meshes made of consecutive parts of a field, in order
+static IndexedMesh join_meshes(std::vector<IndexedMesh>& parts)
 {
-    std::vector<std::vector<std::vector<glm::vec3>>> gradients;
+    std::vector<size_t> first_vertex(parts.size() + 1, 0);
+    std::vector<size_t> first_index(parts.size() + 1, 0);
+    for (size_t p = 0; p < parts.size(); p++) {
+        first_vertex[p + 1] = first_vertex[p] + parts[p].vertices.size();
+        first_index[p + 1] = first_index[p] + parts[p].indices.size();
+    }
+    if (first_vertex.back() > UINT32_MAX) {
+        throw std::runtime_error("The isosurface has too many vertices for 32 bit indices.");
+    }
 
-    gradients.resize(field.dimension.x);
-    for(int i = 0; i < field.dimension.x; i++) {
-        gradients[i].resize(field.dimension.y);
-        for(int j = 0; j < field.dimension.y; j++) {
-            gradients[i][j].resize(field.dimension.z);
-            for(int k = 0; k < field.dimension.z; k++) {
-                glm::vec3 gradient = glm::vec3(0.0f);
-                if (i > 0 && i < field.dimension.x - 1) {
-                    gradient.x = (field(i + 1, j, k) - field(i - 1, j, k)) / (2 * field.spacing.x);
-                }
-                if (j > 0 && j < field.dimension.y - 1) {
-                    gradient.y = (field(i, j + 1, k) - field(i, j - 1, k)) / (2 * field.spacing.y);
-                }
-                if (k > 0 && k < field.dimension.z - 1) {
-                    gradient.z = (field(i, j, k + 1) - field(i, j, k - 1)) / (2 * field.spacing.z);
-                }
-                gradients[i][j][k] = gradient;
+    IndexedMesh mesh;
+    mesh.vertices.resize(first_vertex.back());
+    mesh.normals.resize(first_vertex.back());
+    mesh.indices.resize(first_index.back());
+    parallel_for(parts.size(), [&](size_t p) {
+        std::copy(parts[p].vertices.begin(), parts[p].vertices.end(), mesh.vertices.begin() + first_vertex[p]);
+        std::copy(parts[p].normals.begin(), parts[p].normals.end(), mesh.normals.begin() + first_vertex[p]);
+        const uint32_t offset = uint32_t(first_vertex[p]);
+        std::transform(parts[p].indices.begin(), parts[p].indices.end(), mesh.indices.begin() + first_index[p],
+                [offset](uint32_t index) { return index + offset; });
+        parts[p] = IndexedMesh();
+    });
+    return mesh;
+}
+
+// Joins the triangles of consecutive slabs of a field, in slab order, so they
+// come out layer by layer whatever the number of threads
+static std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> join_slabs(std::vector<std::vector<glm::vec3>>& slab_vertices, std::vector<std::vector<glm::vec3>>& slab_normals)
+{
+    const size_t slabs = slab_vertices.size();
+    std::vector<size_t> first(slabs + 1, 0);
+    for (size_t s = 0; s < slabs; s++) {
+        first[s + 1] = first[s] + slab_vertices[s].size();
+    }
+    std::vector<glm::vec3> triangle_vertices(first[slabs]);
+    std::vector<glm::vec3> vertex_normals(first[slabs]);
+    parallel_for(slabs, [&](size_t s) {
+        std::copy(slab_vertices[s].begin(), slab_vertices[s].end(), triangle_vertices.begin() + first[s]);
+        std::copy(slab_normals[s].begin(), slab_normals[s].end(), vertex_normals.begin() + first[s]);
+        slab_vertices[s] = std::vector<glm::vec3>();
+        slab_normals[s] = std::vector<glm::vec3>();
+    });
+    return { std::move(triangle_vertices), std::move(vertex_normals) };
+}
+
+// The gradients of two consecutive slices, indexed like a GradientField. A cell
+// layer needs no others, so a slab that computes each slice just before the
+// layer above it keeps only these hot instead of the whole field's. Slice k
+// takes the place of slice k - 2.
+struct SliceGradients {
+    Dimension dimension;
+    std::vector<glm::vec3> data;
+
+    explicit SliceGradients(Dimension d)
+        : dimension(d), data(size_t(d.x) * d.y * 2) {}
+
+    glm::vec3& operator()(size_t x, size_t y, size_t z)
+    {
+        return data[x + (y + (z & 1) * dimension.y) * dimension.x];
+    }
+
+    const glm::vec3& operator()(size_t x, size_t y, size_t z) const
+    {
+        return data[x + (y + (z & 1) * dimension.y) * dimension.x];
+    }
+};
+
+// Each slab computes the gradients of a slice right before the cell layer
+// that first needs them, so the samples and gradients of the two slices of the
+// layer at hand are all it reads, and the field's gradients are never stored
+template<typename T>
+std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> MarchingCubes::triangulate_field(VTKField<T>& field, double isovalue)
+{
+    const int layers = field.dimension.z - 1;
+    const size_t slabs = slab_count(layers);
+    std::vector<std::vector<glm::vec3>> slab_vertices(slabs);
+    std::vector<std::vector<glm::vec3>> slab_normals(slabs);
+    parallel_for(slabs, [&](size_t s) {
+        SliceGradients gradients(field.dimension);
+        LayerSigns signs;
+        const int z_begin = slab_begin(s, slabs, layers);
+        compute_gradient_slice(field, gradients, z_begin);
+        for (int z = z_begin; z < slab_begin(s + 1, slabs, layers); z++) {
+            compute_gradient_slice(field, gradients, z + 1);
+            triangulate_layer(slab_vertices[s], slab_normals[s], signs, field, gradients, z, isovalue);
+        }
+    });
+    return join_slabs(slab_vertices, slab_normals);
+}
+
+template<typename T>
+std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> MarchingCubes::triangulate_field(VTKField<T>& field, const GradientField& gradients, double isovalue)
+{
+    // Slabs of cell layers are triangulated in parallel, each into buffers of its own
+    const int layers = field.dimension.z - 1;
+    const size_t slabs = slab_count(layers);
+    std::vector<std::vector<glm::vec3>> slab_vertices(slabs);
+    std::vector<std::vector<glm::vec3>> slab_normals(slabs);
+    parallel_for(slabs, [&](size_t s) {
+        LayerSigns signs;
+        for (int z = slab_begin(s, slabs, layers); z < slab_begin(s + 1, slabs, layers); z++) {
+            triangulate_layer(slab_vertices[s], slab_normals[s], signs, field, gradients, z, isovalue);
+        }
+    });
+    return join_slabs(slab_vertices, slab_normals);
+}
+
+template<typename T>
+IndexedMesh MarchingCubes::triangulate_indexed(VTKField<T>& field, const GradientField& gradients, double isovalue)
+{
+    return triangulate_indexed(field, gradients, MinMaxTree::build(field), isovalue);
+}
+
+template<typename T>
+IndexedMesh MarchingCubes::triangulate_indexed(VTKField<T>& field, const GradientField& gradients, const MinMaxTree& ranges, double isovalue)
+{
+    // Slabs are whole block layers. Each welds its own vertices, so only the
+    // slices where two slabs meet have their vertices twice.
+    const int block_layers = ranges.block_layers();
+    const size_t slabs = slab_count(block_layers);
+    std::vector<IndexedMesh> slab_meshes(slabs);
+    parallel_for(slabs, [&](size_t s) {
+        LayerEdges edges(field.dimension);
+        LayerSigns signs;
+        std::vector<glm::ivec2> blocks;
+        for (int bz = slab_begin(s, slabs, block_layers); bz < slab_begin(s + 1, slabs, block_layers); bz++) {
+            blocks.clear();
+            ranges.active_blocks(bz, isovalue, blocks);
+            if (blocks.empty()) {
+                continue;
+            }
+            const int z_end = std::min((bz + 1) * MINMAX_BLOCK, field.dimension.z - 1);
+            for (int z = bz * MINMAX_BLOCK; z < z_end; z++) {
+                triangulate_blocks_indexed(slab_meshes[s], edges, signs, field, gradients, blocks, z, isovalue);
             }
         }
+    });
+    return join_meshes(slab_meshes);
+}
+
+template<typename T>
+GradientField MarchingCubes::compute_gradient(VTKField<T>& field)
+{
+    GradientField gradients(field.dimension);
+
+    const size_t slabs = slab_count(field.dimension.z);
+    parallel_for(slabs, [&](size_t s) {
+        for (int k = slab_begin(s, slabs, field.dimension.z); k < slab_begin(s + 1, slabs, field.dimension.z); k++) {
+            compute_gradient_slice(field, gradients, k);
+        }
+    });
+
+    return gradients;
+}
+
+// One gradient component, (a - b) / d. Differences of double samples are
+// taken in double, all others in float.
+template<typename T>
+static float difference(T a, T b, float d)
+{
+    using Acc = std::conditional_t<std::is_same_v<T, double>, double, float>;
+    return float((Acc(a) - Acc(b)) / Acc(d));
+}
+
+template<typename T>
+static void difference_row(const T* a, const T* b, float d, float* out, int n)
+{
+    for (int i = 0; i < n; i++) {
+        out[i] = difference(a[i], b[i], d);
     }
+}
 
-    // Boundary conditions: Forward and backward differences
-    for (int i = 0; i < field.dimension.x; i++) {
-        for (int j = 0; j < field.dimension.y; j++) {
-            gradients[i][j][0].z = (field(i, j, 1) - field(i, j, 0)) / field.spacing.z;
-            gradients[i][j][field.dimension.z - 1].z = (field(i, j, field.dimension.z - 1) - field(i, j, field.dimension.z - 2)) / field.spacing.z;
+// Gradients of slice k only read slices k - 1 to k + 1. Central differences
+// inside, forward and backward differences on the boundary. Each component is
+// computed for a whole row by a loop the compiler vectorizes, and then
+// interleaved into the row's vectors.
+template<typename T, typename Gradients>
+void MarchingCubes::compute_gradient_slice(VTKField<T>& field, Gradients& gradients, int k)
+{
+    const Dimension& dim = field.dimension;
+    const Spacing& spacing = field.spacing;
+    const T* samples = field.data.data();
+    auto row = [&](int j, int z) { return samples + (size_t(z) * dim.y + j) * dim.x; };
+
+    std::vector<float> gx(dim.x, 0.0f);
+    std::vector<float> gy(dim.x, 0.0f);
+    std::vector<float> gz(dim.x, 0.0f);
+
+    // Neighbouring slices along z are the same for every row of the slice
+    const int z_up = std::min(k + 1, dim.z - 1);
+    const int z_down = std::max(k - 1, 0);
+    const float z_distance = (z_up - z_down == 2 ? 2 * spacing.z : spacing.z);
+
+    for (int j = 0; j < dim.y; j++) {
+        const T* center = row(j, k);
+        if (dim.x > 1) {
+            gx[0] = difference(center[1], center[0], spacing.x);
+            difference_row(center + 2, center, 2 * spacing.x, gx.data() + 1, dim.x - 2);
+            gx[dim.x - 1] = difference(center[dim.x - 1], center[dim.x - 2], spacing.x);
         }
+
+        const int y_up = std::min(j + 1, dim.y - 1);
+        const int y_down = std::max(j - 1, 0);
+        if (y_up != y_down) {
+            difference_row(row(y_up, k), row(y_down, k), (y_up - y_down == 2 ? 2 * spacing.y : spacing.y), gy.data(), dim.x);
+        }
+        if (z_up != z_down) {
+            difference_row(row(j, z_up), row(j, z_down), z_distance, gz.data(), dim.x);
+        }
+
+        glm::vec3* out = &gradients(0, j, k);
+        for (int i = 0; i < dim.x; i++) {
+            out[i] = glm::vec3(gx[i], gy[i], gz[i]);
+        }
+    }
+}
+
+// The layers are classified a row of cells at a time, and only the cells the
+// surface crosses are triangulated
+template<typename T, typename Gradients>
+void MarchingCubes::triangulate_layer(std::vector<glm::vec3>& triangle_vertices, std::vector<glm::vec3>& vertex_normals, LayerSigns& signs, VTKField<T>& field, const Gradients& gradients, int z, double isovalue)
+{
+    signs.classify(field, glm::ivec3(0, 0, z), glm::ivec2(field.dimension.x - 1, field.dimension.y - 1), isovalue);
+    for (int y = 0; y < field.dimension.y - 1; y++) {
+        signs.crossed_cells(y, [&](int x, int cube_index) {
+            triangulate_cell(triangle_vertices, vertex_normals, field, gradients, glm::ivec3(x, y, z), cube_index, isovalue);
+        });
     }
+}
 
-    for (int i = 0; i < field.dimension.x; i++) {
-        for (int k = 0; k < field.dimension.z; k++) {
-            gradients[i][0][k].y = (field(i, 1, k) - field(i, 0, k)) / field.spacing.y;
-            gradients[i][field.dimension.y - 1][k].y = (field(i, field.dimension.y - 1, k) - field(i, field.dimension.y - 2, k)) / field.spacing.y;
+template<typename T>
+void MarchingCubes::triangulate_layer_indexed(IndexedMesh& mesh, LayerEdges& edges, LayerSigns& signs, VTKField<T>& field, const GradientField& gradients, int z, double isovalue)
+{
+    edges.begin_layer(z);
+    signs.classify(field, glm::ivec3(0, 0, z), glm::ivec2(field.dimension.x - 1, field.dimension.y - 1), isovalue);
+    for (int y = 0; y < field.dimension.y - 1; y++) {
+        signs.crossed_cells(y, [&](int x, int cube_index) {
+            triangulate_cell_indexed(mesh, edges, field, gradients, glm::ivec3(x, y, z), cube_index, isovalue);
+        });
+    }
+}
+
+template<typename T>
+void MarchingCubes::triangulate_blocks_indexed(IndexedMesh& mesh, LayerEdges& edges, LayerSigns& signs, VTKField<T>& field, const GradientField& gradients, const std::vector<glm::ivec2>& blocks, int z, double isovalue)
+{
+    edges.begin_layer(z);
+    for (const glm::ivec2& block : blocks) {
+        const glm::ivec2 begin = block * MINMAX_BLOCK;
+        const glm::ivec2 cells = glm::ivec2(
+                std::min(MINMAX_BLOCK, field.dimension.x - 1 - begin.x),
+                std::min(MINMAX_BLOCK, field.dimension.y - 1 - begin.y));
+        signs.classify(field, glm::ivec3(begin.x, begin.y, z), cells, isovalue);
+        for (int y = 0; y < cells.y; y++) {
+            signs.crossed_cells(y, [&](int x, int cube_index) {
+                triangulate_cell_indexed(mesh, edges, field, gradients, glm::ivec3(begin.x + x, begin.y + y, z), cube_index, isovalue);
+            });
         }
     }
+}
 
-    for (int j = 0; j < field.dimension.y; j++) {
-        for (int k = 0; k < field.dimension.z; k++) {
-            gradients[0][j][k].x = (field(1, j, k) - field(0, j, k)) / field.spacing.x;
-            gradients[field.dimension.x - 1][j][k].x = (field(field.dimension.x - 1, j, k) - field(field.dimension.x - 2, j, k)) / field.spacing.x;
+template<typename T>
+IndexedMesh MarchingCubes::triangulate_slices(VTKField<T>& field, GradientField& computed, double isovalue, int ready, const std::function<int()>& next_ready)
+{
+    const int slices = field.dimension.z;
+    GradientField gradients(field.dimension);
+    IndexedMesh mesh;
+    LayerEdges edges(field.dimension);
+    LayerSigns signs;
+
+    int gradient_slices = 0;
+    int cell_layers = 0;
+    while (true) {
+        // Slice k needs the samples of slice k + 1, layer z the gradients of slice z + 1
+        while (gradient_slices < slices && std::min(gradient_slices + 1, slices - 1) < ready) {
+            compute_gradient_slice(field, gradients, gradient_slices++);
+        }
+        while (cell_layers < slices - 1 && cell_layers + 1 < gradient_slices) {
+            triangulate_layer_indexed(mesh, edges, signs, field, gradients, cell_layers++, isovalue);
         }
+        if (ready >= slices) {
+            break;
+        }
+        ready = std::max(ready, next_ready());
     }
 
-    return gradients;
+    // Only handed out once complete, so a failed parse leaves `computed` empty
+    computed = std::move(gradients);
+    return mesh;
 }
 
-void MarchingCubes::triangulate_cell(std::vector<glm::vec3>& triangle_vertices, std::vector<glm::vec3>& vertex_normals,VTKField<double>& field, std::vector<std::vector<std::vector<glm::vec3>>>& gradients, glm::ivec3 cell_origin, double isovalue)
+IndexedMesh MarchingCubes::triangulate_streaming(VTKData& data, size_t i, double isovalue, GradientField& gradients, MinMaxTree& ranges)
 {
-    double scalar_vals[8] = { 
-        field(cell_origin.x, cell_origin.y, cell_origin.z),
-        field(cell_origin.x + 1, cell_origin.y, cell_origin.z),
-        field(cell_origin.x + 1, cell_origin.y + 1, cell_origin.z),
-        field(cell_origin.x, cell_origin.y + 1, cell_origin.z),
-        field(cell_origin.x, cell_origin.y, cell_origin.z + 1),
-        field(cell_origin.x + 1, cell_origin.y, cell_origin.z + 1),
-        field(cell_origin.x + 1, cell_origin.y + 1, cell_origin.z + 1),
-        field(cell_origin.x, cell_origin.y + 1, cell_origin.z + 1)
+    if (data.is_loaded(i)) {
+        return std::visit([&](auto& field) {
+            if (gradients.data.empty()) {
+                gradients = compute_gradient(field);
+            }
+            if (ranges.empty()) {
+                ranges = MinMaxTree::build(field);
+            }
+            return triangulate_indexed(field, gradients, ranges, isovalue);
+        }, data.fields[i]);
+    }
+
+    // Slice counts from the parser. Only the latest count matters, so the
+    // parser drops counts while the queue is full instead of waiting. -1
+    // reports a parse error.
+    SpscQueue<int, 64> queue;
+    std::atomic<bool> cancelled(false);
+    std::exception_ptr parse_error;
+
+    auto push_final = [&](int slices) {
+        while (!queue.try_push(slices) && !cancelled) {
+            std::this_thread::yield();
+        }
     };
 
-    std::vector<glm::vec3> grads = {
-        gradients[cell_origin.x][cell_origin.y][cell_origin.z],
-        gradients[cell_origin.x + 1][cell_origin.y][cell_origin.z],
-        gradients[cell_origin.x + 1][cell_origin.y + 1][cell_origin.z],
-        gradients[cell_origin.x][cell_origin.y + 1][cell_origin.z],
-        gradients[cell_origin.x][cell_origin.y][cell_origin.z + 1],
-        gradients[cell_origin.x + 1][cell_origin.y][cell_origin.z + 1],
-        gradients[cell_origin.x + 1][cell_origin.y + 1][cell_origin.z + 1],
-        gradients[cell_origin.x][cell_origin.y + 1][cell_origin.z + 1]
+    std::thread parser([&]() {
+        try {
+            data.stream_field(i, [&](int slices) { queue.try_push(slices); });
+            push_final(data.dimension.z);
+        } catch (...) {
+            parse_error = std::current_exception();
+            push_final(-1);
+        }
+    });
+
+    auto next_ready = [&]() {
+        int slices;
+        while (!queue.try_pop(slices)) {
+            std::this_thread::yield();
+        }
+        if (slices < 0) {
+            throw std::runtime_error("Parsing failed");
+        }
+        return slices;
     };
 
-    int cube_index = 0;
-    if (scalar_vals[0] < isovalue) cube_index |= 1;
-    if (scalar_vals[1] < isovalue) cube_index |= 2;
-    if (scalar_vals[2] < isovalue) cube_index |= 4;
-    if (scalar_vals[3] < isovalue) cube_index |= 8;
-    if (scalar_vals[4] < isovalue) cube_index |= 16;
-    if (scalar_vals[5] < isovalue) cube_index |= 32;
-    if (scalar_vals[6] < isovalue) cube_index |= 64;
-    if (scalar_vals[7] < isovalue) cube_index |= 128;
+    try {
+        // The field's storage is in place once the first count arrives
+        int ready = next_ready();
+        auto result = std::visit([&](auto& field) {
+            return triangulate_slices(field, gradients, isovalue, ready, next_ready);
+        }, data.fields[i]);
+        parser.join();
+
+        // The block ranges need every slice, so they are only built at the end
+        if (ranges.empty()) {
+            std::visit([&](auto& field) { ranges = MinMaxTree::build(field); }, data.fields[i]);
+        }
+        return result;
+    } catch (...) {
+        cancelled = true;
+        parser.join();
+        if (parse_error) {
+            data.fields[i] = VTKFieldVariant();
+            std::rethrow_exception(parse_error);
+        }
+        throw;
+    }
+}
+
+template<typename T>
+std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> MarchingCubes::triangulate_bricked(const BrickedField<T>& field, double isovalue)
+{
+    std::vector<glm::vec3> triangle_vertices;
+    std::vector<glm::vec3> vertex_normals;
+    const Dimension& dim = field.dimension;
+
+    // Bricks in the field's x fastest order, like the cells within a brick
+    for (int z0 = 0; z0 < dim.z - 1; z0 += BRICK_EDGE) {
+        for (int y0 = 0; y0 < dim.y - 1; y0 += BRICK_EDGE) {
+            for (int x0 = 0; x0 < dim.x - 1; x0 += BRICK_EDGE) {
+                // The cells of this brick use samples [x0, x0 + BRICK_EDGE], and
+                // their gradients one more sample on either side
+                const Dimension begin = {std::max(x0 - 1, 0), std::max(y0 - 1, 0), std::max(z0 - 1, 0)};
+                const Dimension end = {
+                    std::min(x0 + BRICK_EDGE + 2, dim.x),
+                    std::min(y0 + BRICK_EDGE + 2, dim.y),
+                    std::min(z0 + BRICK_EDGE + 2, dim.z)
+                };
+                VTKField<T> window = field.read_box(begin, {end.x - begin.x, end.y - begin.y, end.z - begin.z});
+                auto gradients = compute_gradient(window);
 
-    if(EDGE_TBL[cube_index] == 0) {
-        return;
+                const size_t first_vertex = triangle_vertices.size();
+                const glm::ivec3 cells = glm::ivec3(
+                        std::min(x0 + BRICK_EDGE, dim.x - 1) - x0,
+                        std::min(y0 + BRICK_EDGE, dim.y - 1) - y0,
+                        std::min(z0 + BRICK_EDGE, dim.z - 1) - z0);
+                const glm::ivec3 origin = glm::ivec3(x0 - begin.x, y0 - begin.y, z0 - begin.z);
+                LayerSigns signs;
+                for (int z = origin.z; z < origin.z + cells.z; z++) {
+                    signs.classify(window, glm::ivec3(origin.x, origin.y, z), glm::ivec2(cells.x, cells.y), isovalue);
+                    for (int y = 0; y < cells.y; y++) {
+                        signs.crossed_cells(y, [&](int x, int cube_index) {
+                            triangulate_cell(triangle_vertices, vertex_normals, window, gradients, glm::ivec3(origin.x + x, origin.y + y, z), cube_index, isovalue);
+                        });
+                    }
+                }
+
+                // Back from window to field coordinates
+                const glm::vec3 offset = glm::vec3(begin.x * field.spacing.x, begin.y * field.spacing.y, begin.z * field.spacing.z);
+                for (size_t v = first_vertex; v < triangle_vertices.size(); v++) {
+                    triangle_vertices[v] += offset;
+                }
+            }
+        }
+    }
+
+    return { triangle_vertices, vertex_normals };
+}
+
+template<typename T, typename Gradients>
+void MarchingCubes::triangulate_cell(std::vector<glm::vec3>& triangle_vertices, std::vector<glm::vec3>& vertex_normals,VTKField<T>& field, const Gradients& gradients, glm::ivec3 cell_origin, int cube_index, double isovalue)
+{
+    double scalar_vals[8];
+    for (int i = 0; i < 8; i++) {
+        scalar_vals[i] = field(cell_origin.x + x_delta[i], cell_origin.y + y_delta[i], cell_origin.z + z_delta[i]);
     }
 
     glm::vec3 vertices[12];
@@ -125,8 +634,8 @@ void MarchingCubes::triangulate_cell(std::vector<glm::vec3>& triangle_vertices,
             vertices[i] = glm::mix(p1, p2, t);
 
             // Trilinear interpolation for the normals
-            glm::vec3 g1 = grads[v1];
-            glm::vec3 g2 = grads[v2];
+            glm::vec3 g1 = gradients(cell_origin.x + x_delta[v1], cell_origin.y + y_delta[v1], cell_origin.z + z_delta[v1]);
+            glm::vec3 g2 = gradients(cell_origin.x + x_delta[v2], cell_origin.y + y_delta[v2], cell_origin.z + z_delta[v2]);
             normals[i] = glm::normalize(glm::mix(g1, g2, t));
         }
     }
@@ -140,3 +649,133 @@ void MarchingCubes::triangulate_cell(std::vector<glm::vec3>& triangle_vertices,
         vertex_normals.push_back(normals[TRI_TBL[cube_index][i + 2]]);
     }
 }
+
+template<typename T>
+void MarchingCubes::triangulate_cell_indexed(IndexedMesh& mesh, LayerEdges& edges, VTKField<T>& field, const GradientField& gradients, glm::ivec3 cell_origin, int cube_index, double isovalue)
+{
+    double scalar_vals[8];
+    for (int i = 0; i < 8; i++) {
+        scalar_vals[i] = field(cell_origin.x + x_delta[i], cell_origin.y + y_delta[i], cell_origin.z + z_delta[i]);
+    }
+
+    uint32_t vertices[12];
+    for (int i = 0; i < 12; i++) {
+        if (!(EDGE_TBL[cube_index] & (1 << i))) {
+            continue;
+        }
+
+        // A neighbour that shares the edge may have made its vertex already
+        vertices[i] = edges.vertex(i, cell_origin.x, cell_origin.y, [&]() {
+            const int v1 = edge_start[i];
+            const int v2 = edge_end[i];
+            const glm::ivec3 c1 = cell_origin + glm::ivec3(x_delta[v1], y_delta[v1], z_delta[v1]);
+            const glm::ivec3 c2 = cell_origin + glm::ivec3(x_delta[v2], y_delta[v2], z_delta[v2]);
+
+            mesh.vertices.emplace_back();
+            mesh.normals.emplace_back();
+            edge_vertex(field, gradients, c1, c2, scalar_vals[v1], scalar_vals[v2], isovalue, mesh.vertices.back(), mesh.normals.back());
+            if (edges.vertex_edges) {
+                edges.vertex_edges->push_back(edge_key(c1, edge_axis[i]));
+            }
+            return uint32_t(mesh.vertices.size() - 1);
+        });
+    }
+
+    for (int i = 0; TRI_TBL[cube_index][i] != 16; i++) {
+        mesh.indices.push_back(vertices[TRI_TBL[cube_index][i]]);
+    }
+}
+
+template<typename T>
+void MarchingCubes::block_cases(BlockScratch& scratch, VTKField<T>& field, glm::ivec3 block, double isovalue, uint8_t* cases, double& below, double& above)
+{
+    constexpr int B = MINMAX_BLOCK;
+    const glm::ivec3 begin = block * B;
+    const glm::ivec3 cells = glm::ivec3(
+            std::min(B, field.dimension.x - 1 - begin.x),
+            std::min(B, field.dimension.y - 1 - begin.y),
+            std::min(B, field.dimension.z - 1 - begin.z));
+
+    below = -std::numeric_limits<double>::infinity();
+    above = std::numeric_limits<double>::infinity();
+    for (int z = 0; z <= cells.z; z++) {
+        for (int y = 0; y <= cells.y; y++) {
+            const T* row = &field(begin.x, begin.y + y, begin.z + z);
+            for (int x = 0; x <= cells.x; x++) {
+                // A NaN is never below any isovalue, so it bounds neither side
+                const double v = double(row[x]);
+                if (v < isovalue) {
+                    below = std::max(below, v);
+                } else if (v >= isovalue) {
+                    above = std::min(above, v);
+                }
+            }
+        }
+    }
+
+    std::fill(cases, cases + B * B * B, 0);
+    LayerSigns& signs = *scratch.m_signs;
+    for (int z = 0; z < cells.z; z++) {
+        signs.classify(field, begin + glm::ivec3(0, 0, z), glm::ivec2(cells.x, cells.y), isovalue);
+        for (int y = 0; y < cells.y; y++) {
+            signs.crossed_cells(y, [&](int x, int cube_index) {
+                cases[x + y * B + z * B * B] = uint8_t(cube_index);
+            });
+        }
+    }
+}
+
+template<typename T>
+void MarchingCubes::triangulate_block(IndexedMesh& mesh, std::vector<uint64_t>& vertex_edges, BlockScratch& scratch, VTKField<T>& field, const GradientField& gradients, glm::ivec3 block, const uint8_t* cases, double isovalue)
+{
+    const glm::ivec3 begin = block * MINMAX_BLOCK;
+    const glm::ivec3 end = glm::ivec3(
+            std::min(begin.x + MINMAX_BLOCK, field.dimension.x - 1),
+            std::min(begin.y + MINMAX_BLOCK, field.dimension.y - 1),
+            std::min(begin.z + MINMAX_BLOCK, field.dimension.z - 1));
+
+    LayerEdges& edges = *scratch.m_edges;
+    edges.restart(glm::ivec2(begin.x, begin.y));
+    edges.vertex_edges = &vertex_edges;
+    for (int z = begin.z; z < end.z; z++) {
+        edges.begin_layer(z);
+        for (int y = begin.y; y < end.y; y++) {
+            for (int x = begin.x; x < end.x; x++) {
+                // Only the cells the surface crosses are looked at again
+                const uint8_t cube_index = cases[(x - begin.x) + (y - begin.y) * MINMAX_BLOCK + (z - begin.z) * MINMAX_BLOCK * MINMAX_BLOCK];
+                if (cube_index != 0) {
+                    triangulate_cell_indexed(mesh, edges, field, gradients, glm::ivec3(x, y, z), cube_index, isovalue);
+                }
+            }
+        }
+    }
+}
+
+template<typename T>
+void MarchingCubes::move_vertices(glm::vec3* vertices, glm::vec3* normals, const uint64_t* vertex_edges, size_t count, VTKField<T>& field, const GradientField& gradients, double isovalue)
+{
+    constexpr uint64_t mask = (uint64_t(1) << 21) - 1;
+    for (size_t v = 0; v < count; v++) {
+        const uint64_t key = vertex_edges[v];
+        const glm::ivec3 c1 = glm::ivec3(int(key & mask), int(key >> 21 & mask), int(key >> 42 & (mask >> 1)));
+        glm::ivec3 c2 = c1;
+        c2[int(key >> 62)]++;
+        edge_vertex(field, gradients, c1, c2, double(field(c1.x, c1.y, c1.z)), double(field(c2.x, c2.y, c2.z)), isovalue, vertices[v], normals[v]);
+    }
+}
+
+#define INSTANTIATE_MARCHING_CUBES(T) \
+    template std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> MarchingCubes::triangulate_field<T>(VTKField<T>&, double); \
+    template std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> MarchingCubes::triangulate_field<T>(VTKField<T>&, const GradientField&, double); \
+    template std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> MarchingCubes::triangulate_bricked<T>(const BrickedField<T>&, double); \
+    template IndexedMesh MarchingCubes::triangulate_indexed<T>(VTKField<T>&, const GradientField&, double); \
+    template IndexedMesh MarchingCubes::triangulate_indexed<T>(VTKField<T>&, const GradientField&, const MinMaxTree&, double); \
+    template GradientField MarchingCubes::compute_gradient<T>(VTKField<T>&); \
+    template void MarchingCubes::block_cases<T>(BlockScratch&, VTKField<T>&, glm::ivec3, double, uint8_t*, double&, double&); \
+    template void MarchingCubes::triangulate_block<T>(IndexedMesh&, std::vector<uint64_t>&, BlockScratch&, VTKField<T>&, const GradientField&, glm::ivec3, const uint8_t*, double); \
+    template void MarchingCubes::move_vertices<T>(glm::vec3*, glm::vec3*, const uint64_t*, size_t, VTKField<T>&, const GradientField&, double);
+
+INSTANTIATE_MARCHING_CUBES(double)
+INSTANTIATE_MARCHING_CUBES(float)
+INSTANTIATE_MARCHING_CUBES(short)
+INSTANTIATE_MARCHING_CUBES(unsigned char)
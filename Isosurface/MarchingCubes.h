@@ -1,16 +1,150 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <glm/glm.hpp>
+#include <memory>
 #include <utility>
 #include <vector>
+#include <BrickedField.h>
 #include <VTKParser.h>
+#include "MinMaxTree.h"
 
+// Gradients of a field at its samples, stored flat in the same x fastest order
+// as VTKField::data. The vectors are packed floats, so data can be uploaded as
+// an RGB float texture as it is.
+struct GradientField {
+    Dimension dimension;
+    std::vector<glm::vec3> data;
+
+    GradientField() = default;
+    explicit GradientField(Dimension d)
+        : dimension(d), data(size_t(d.x) * d.y * d.z) {}
+
+    glm::vec3& operator()(size_t x, size_t y, size_t z)
+    {
+        return data[x + y * dimension.x + z * dimension.x * dimension.y];
+    }
+
+    const glm::vec3& operator()(size_t x, size_t y, size_t z) const
+    {
+        return data[x + y * dimension.x + z * dimension.x * dimension.y];
+    }
+};
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "GradientField is uploaded as packed RGB floats");
+
+// A triangle mesh whose vertices are shared by the triangles around them, for
+// drawing with glDrawElements. Each triangle is three consecutive indices.
+struct IndexedMesh {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<uint32_t> indices;
+};
+
+// The kernels are templates over the field's sample type and are instantiated
+// in MarchingCubes.cpp for every type VTKFieldVariant can hold.
 class MarchingCubes
 {
+    // Vertex indices of the grid edges of one cell layer
+    struct LayerEdges;
+    // Which cells of a cell layer the surface crosses, and their cases
+    struct LayerSigns;
+
 public:
-    static std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> triangulate_field(VTKField<double>& field, double isovalue);
-    static std::vector<std::vector<std::vector<glm::vec3>>> compute_gradient(VTKField<double>& field);
+    // The gradients are computed a slice at a time along the way, never for
+    // the whole field at once
+    template<typename T>
+    static std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> triangulate_field(VTKField<T>& field, double isovalue);
+    // Same, with the field's gradients from an earlier compute_gradient. They
+    // only depend on the samples, so they can be kept across isovalues.
+    template<typename T>
+    static std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> triangulate_field(VTKField<T>& field, const GradientField& gradients, double isovalue);
+    template<typename T>
+    static GradientField compute_gradient(VTKField<T>& field);
+
+    // The same surface as an IndexedMesh. A vertex is made once per grid edge
+    // the surface crosses and shared by the up to four cells around that edge,
+    // instead of once per triangle corner. Only the edges of the cell layer
+    // at hand are looked up, so the extra memory is a few slices of indices.
+    template<typename T>
+    static IndexedMesh triangulate_indexed(VTKField<T>& field, const GradientField& gradients, double isovalue);
+    // Same, only visiting the blocks of cells `ranges` (built for this field)
+    // says the isovalue crosses, so the work follows the size of the surface
+    // rather than that of the field
+    template<typename T>
+    static IndexedMesh triangulate_indexed(VTKField<T>& field, const GradientField& gradients, const MinMaxTree& ranges, double isovalue);
+
+    // The parts of triangulate_indexed an IncrementalSurface updates a surface
+    // with, for one level 0 block of a MinMaxTree at a time.
+
+    // What block_cases and triangulate_block work in. Handing the same one to
+    // block after block saves each block allocating its own.
+    class BlockScratch {
+    public:
+        BlockScratch();
+        BlockScratch(BlockScratch&&) noexcept;
+        BlockScratch& operator=(BlockScratch&&) noexcept;
+        ~BlockScratch();
+
+    private:
+        friend class MarchingCubes;
+        std::unique_ptr<LayerEdges> m_edges;
+        std::unique_ptr<LayerSigns> m_signs;
+    };
+
+    // Case index (see EDGE_TBL) of each cell of a block, MINMAX_BLOCK^3 of
+    // them with x fastest. Cells the surface does not cross, and cells past
+    // the end of the field, are 0. `below` and
+    // `above` are set to the block's largest sample below the isovalue and its
+    // smallest sample that is not (or -/+infinity), so the cases stay the same
+    // for every isovalue in (below, above].
+    template<typename T>
+    static void block_cases(BlockScratch& scratch, VTKField<T>& field, glm::ivec3 block, double isovalue, uint8_t* cases, double& below, double& above);
+    // Triangulates the cells of a block, given their cases from block_cases,
+    // appending to mesh. The vertices are shared within the block only; the
+    // grid edge of each vertex made is appended to vertex_edges.
+    template<typename T>
+    static void triangulate_block(IndexedMesh& mesh, std::vector<uint64_t>& vertex_edges, BlockScratch& scratch, VTKField<T>& field, const GradientField& gradients, glm::ivec3 block, const uint8_t* cases, double isovalue);
+    // Moves vertices made at another isovalue along their grid edges, to where
+    // `isovalue` crosses them. Gives the same vertices as triangulating anew,
+    // as long as the cells around them kept their cases.
+    template<typename T>
+    static void move_vertices(glm::vec3* vertices, glm::vec3* normals, const uint64_t* vertex_edges, size_t count, VTKField<T>& field, const GradientField& gradients, double isovalue);
+
+    // Triangulates the i-th field of data while it is still being parsed. The
+    // parser runs on its own thread and hands the number of completed z-slices
+    // over a queue; each cell layer is triangulated as soon as the gradients of
+    // its two slices can be computed. A field that is already loaded is simply
+    // triangulated.
+    //
+    // `gradients` and `ranges` are the field's gradients and block ranges if
+    // they are not empty; otherwise they are stored there for the next call.
+    // Gradients are made on the way, block ranges once the last slice is in.
+    // The surface is indexed, as triangulate_indexed makes it.
+    static IndexedMesh triangulate_streaming(VTKData& data, size_t i, double isovalue, GradientField& gradients, MinMaxTree& ranges);
+
+    // Triangulates a field kept out of core, one brick of cells at a time. The
+    // cells of a brick are triangulated on an in-memory copy of their samples
+    // plus the one sample border their gradients need, so only a handful of
+    // bricks is resident at once. Gives the same surface as triangulate_field.
+    template<typename T>
+    static std::pair<std::vector<glm::vec3>,std::vector<glm::vec3>> triangulate_bricked(const BrickedField<T>& field, double isovalue);
 
 private:
-    static void triangulate_cell(std::vector<glm::vec3>& triangle_vertices, std::vector<glm::vec3>& vertex_normals, VTKField<double>& field, std::vector<std::vector<std::vector<glm::vec3>>>& gradients,glm::ivec3 cell_origin, double isovalue);
+    // Consumes slice counts from next_ready() until the whole field is ready
+    template<typename T>
+    static IndexedMesh triangulate_slices(VTKField<T>& field, GradientField& gradients, double isovalue, int ready, const std::function<int()>& next_ready);
+    // Gradients is a GradientField, or anything indexed like one
+    template<typename T, typename Gradients>
+    static void compute_gradient_slice(VTKField<T>& field, Gradients& gradients, int k);
+    template<typename T, typename Gradients>
+    static void triangulate_layer(std::vector<glm::vec3>& triangle_vertices, std::vector<glm::vec3>& vertex_normals, LayerSigns& signs, VTKField<T>& field, const Gradients& gradients, int z, double isovalue);
+    template<typename T, typename Gradients>
+    static void triangulate_cell(std::vector<glm::vec3>& triangle_vertices, std::vector<glm::vec3>& vertex_normals, VTKField<T>& field, const Gradients& gradients,glm::ivec3 cell_origin, int cube_index, double isovalue);
+    template<typename T>
+    static void triangulate_layer_indexed(IndexedMesh& mesh, LayerEdges& edges, LayerSigns& signs, VTKField<T>& field, const GradientField& gradients, int z, double isovalue);
+    template<typename T>
+    static void triangulate_blocks_indexed(IndexedMesh& mesh, LayerEdges& edges, LayerSigns& signs, VTKField<T>& field, const GradientField& gradients, const std::vector<glm::ivec2>& blocks, int z, double isovalue);
+    template<typename T>
+    static void triangulate_cell_indexed(IndexedMesh& mesh, LayerEdges& edges, VTKField<T>& field, const GradientField& gradients, glm::ivec3 cell_origin, int cube_index, double isovalue);
 };
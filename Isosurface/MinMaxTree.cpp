@@ -0,0 +1,122 @@
+#include "MinMaxTree.h"
+
+#include <Parallel.h>
+#include <algorithm>
+#include <limits>
+
+static constexpr double INF = std::numeric_limits<double>::infinity();
+
+// Widens range to the samples row[0, n)
+template<typename T>
+static void extend(MinMaxTree::Range& range, const T* row, int n)
+{
+    for (int i = 0; i < n; i++) {
+        const double v = double(row[i]);
+        if (v < range.min) {
+            range.min = v;
+        }
+        if (!(v <= range.max)) {
+            range.max = v != v ? INF : v;
+        }
+    }
+}
+
+static void merge(MinMaxTree::Range& range, const MinMaxTree::Range& other)
+{
+    range.min = std::min(range.min, other.min);
+    range.max = std::max(range.max, other.max);
+}
+
+template<typename T>
+MinMaxTree MinMaxTree::build(const VTKField<T>& field)
+{
+    MinMaxTree tree;
+    const Dimension& dim = field.dimension;
+    if (dim.x < 2 || dim.y < 2 || dim.z < 2) {
+        return tree;
+    }
+
+    Level leaves;
+    leaves.blocks = {
+        (dim.x - 2) / MINMAX_BLOCK + 1,
+        (dim.y - 2) / MINMAX_BLOCK + 1,
+        (dim.z - 2) / MINMAX_BLOCK + 1
+    };
+    const size_t layer_blocks = size_t(leaves.blocks.x) * leaves.blocks.y;
+    leaves.ranges.assign(layer_blocks * leaves.blocks.z, Range { INF, -INF });
+
+    // A block's cells use samples [b * MINMAX_BLOCK, (b + 1) * MINMAX_BLOCK], so
+    // the samples on a block border count for the blocks on both sides
+    parallel_for(size_t(leaves.blocks.z), [&](size_t bz) {
+        Range* layer = leaves.ranges.data() + bz * layer_blocks;
+        const int z_end = std::min(int(bz + 1) * MINMAX_BLOCK, dim.z - 1);
+        for (int z = int(bz) * MINMAX_BLOCK; z <= z_end; z++) {
+            for (int y = 0; y < dim.y; y++) {
+                const T* row = &field(0, y, z);
+                const int by = std::min(y / MINMAX_BLOCK, leaves.blocks.y - 1);
+                const bool shared = y % MINMAX_BLOCK == 0 && y > 0 && by == y / MINMAX_BLOCK;
+                for (int bx = 0; bx < leaves.blocks.x; bx++) {
+                    const int x_begin = bx * MINMAX_BLOCK;
+                    const int x_end = std::min(x_begin + MINMAX_BLOCK, dim.x - 1);
+                    Range range = { INF, -INF };
+                    extend(range, row + x_begin, x_end - x_begin + 1);
+                    merge(layer[bx + size_t(by) * leaves.blocks.x], range);
+                    if (shared) {
+                        merge(layer[bx + size_t(by - 1) * leaves.blocks.x], range);
+                    }
+                }
+            }
+        }
+    });
+    tree.m_levels.push_back(std::move(leaves));
+
+    while (tree.m_levels.back().ranges.size() > 1) {
+        const Level& below = tree.m_levels.back();
+        Level level;
+        level.blocks = { (below.blocks.x + 1) / 2, (below.blocks.y + 1) / 2, (below.blocks.z + 1) / 2 };
+        level.ranges.assign(size_t(level.blocks.x) * level.blocks.y * level.blocks.z, Range { INF, -INF });
+        for (int z = 0; z < below.blocks.z; z++) {
+            for (int y = 0; y < below.blocks.y; y++) {
+                for (int x = 0; x < below.blocks.x; x++) {
+                    merge(level.ranges[x / 2 + size_t(y / 2) * level.blocks.x + size_t(z / 2) * level.blocks.x * level.blocks.y],
+                            below(x, y, z));
+                }
+            }
+        }
+        tree.m_levels.push_back(std::move(level));
+    }
+    return tree;
+}
+
+void MinMaxTree::active_blocks(int bz, double isovalue, std::vector<glm::ivec2>& out) const
+{
+    if (!empty()) {
+        descend(int(m_levels.size()) - 1, 0, 0, bz, isovalue, out);
+    }
+}
+
+void MinMaxTree::descend(int level, int x, int y, int bz, double isovalue, std::vector<glm::ivec2>& out) const
+{
+    if (!crosses(m_levels[level](x, y, bz >> level), isovalue)) {
+        return;
+    }
+    if (level == 0) {
+        out.push_back(glm::ivec2(x, y));
+        return;
+    }
+
+    const Level& below = m_levels[level - 1];
+    for (int cy = 2 * y; cy < std::min(2 * y + 2, below.blocks.y); cy++) {
+        for (int cx = 2 * x; cx < std::min(2 * x + 2, below.blocks.x); cx++) {
+            descend(level - 1, cx, cy, bz, isovalue, out);
+        }
+    }
+}
+
+#define INSTANTIATE_MINMAX_TREE(T) \
+    template MinMaxTree MinMaxTree::build<T>(const VTKField<T>&);
+
+INSTANTIATE_MINMAX_TREE(double)
+INSTANTIATE_MINMAX_TREE(float)
+INSTANTIATE_MINMAX_TREE(short)
+INSTANTIATE_MINMAX_TREE(unsigned char)
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <VTKParser.h>
+
+// Edge length, in cells, of the blocks at the bottom of a MinMaxTree
+static constexpr int MINMAX_BLOCK = 8;
+
+// Value ranges of the blocks of cells of a field, so the blocks an isosurface
+// does not cross can be skipped without looking at their cells. Level 0 has a
+// range per MINMAX_BLOCK^3 cells; each level above merges 2x2x2 blocks of the
+// one below, up to a single block for the whole field.
+//
+// Like gradients, the ranges only depend on the samples and can be kept while
+// the isovalue changes.
+class MinMaxTree {
+public:
+    struct Range {
+        double min;
+        // +infinity if the block has a NaN, which no isovalue is above
+        double max;
+    };
+
+    MinMaxTree() = default;
+
+    template<typename T>
+    static MinMaxTree build(const VTKField<T>& field);
+
+    bool empty() const { return m_levels.empty(); }
+
+    // Number of level 0 blocks along each axis
+    Dimension blocks() const { return empty() ? Dimension {0, 0, 0} : m_levels[0].blocks; }
+    int block_layers() const { return blocks().z; }
+
+    // Range of the samples of level 0 block (x, y, z)
+    const Range& block(glm::ivec3 b) const { return m_levels[0](b.x, b.y, b.z); }
+
+    // True if the isovalue crosses a cell of a block with this range: a
+    // corner is below the isovalue and one is not
+    static bool crosses(const Range& range, double isovalue)
+    {
+        return range.min < isovalue && range.max >= isovalue;
+    }
+
+    // Appends the (x, y) indices of the level 0 blocks in block layer bz that
+    // have a cell the isovalue crosses, descending only into the blocks above
+    // them whose range holds the isovalue
+    void active_blocks(int bz, double isovalue, std::vector<glm::ivec2>& out) const;
+
+private:
+    struct Level {
+        Dimension blocks;
+        std::vector<Range> ranges;
+
+        const Range& operator()(int x, int y, int z) const
+        {
+            return ranges[x + size_t(y) * blocks.x + size_t(z) * blocks.x * blocks.y];
+        }
+    };
+
+    void descend(int level, int x, int y, int bz, double isovalue, std::vector<glm::ivec2>& out) const;
+
+    // Level 0 first
+    std::vector<Level> m_levels;
+};
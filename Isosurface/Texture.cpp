@@ -43,19 +43,12 @@ Texture3D::Texture3D() {}
 Texture3D::Texture3D(GLuint id, int L, int W, int D)
     : m_id(id), m_L(L), m_W(W), m_D(D) {}
 
-Texture3D Texture3D::from_data(VTKField<double> data, size_t width, size_t height, size_t depth, GLint filter)
+template<typename T>
+Texture3D Texture3D::from_data(const VTKField<T>& data, size_t width, size_t height, size_t depth, GLint filter)
 {
-    std::vector<float> fdata;
-    for (size_t z = 0; z < depth; z++)
-    {
-        for (size_t y = 0; y < height; y++)
-        {
-            for (size_t x = 0; x < width; x++)
-            {
-                fdata.push_back(data(x, y, z));
-            }
-        }
-    }
+    std::vector<float> scratch;
+    const float* fdata = float_samples(data, scratch);
+
     GLuint id;
     glGenTextures(1, &id);
     glActiveTexture(GL_TEXTURE0 + 1);
@@ -67,13 +60,23 @@ Texture3D Texture3D::from_data(VTKField<double> data, size_t width, size_t heigh
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, width, height, depth, 0, GL_RED, GL_FLOAT, fdata.data());
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, width, height, depth, 0, GL_RED, GL_FLOAT, fdata);
 
     glBindTexture(GL_TEXTURE_3D, 0);
 
     return Texture3D(id, width, height, depth);
 }
 
+Texture3D Texture3D::from_data(const VTKFieldVariant& data, size_t width, size_t height, size_t depth, GLint filter)
+{
+    return std::visit([&](const auto& field) { return from_data(field, width, height, depth, filter); }, data);
+}
+
+template Texture3D Texture3D::from_data<double>(const VTKField<double>&, size_t, size_t, size_t, GLint);
+template Texture3D Texture3D::from_data<float>(const VTKField<float>&, size_t, size_t, size_t, GLint);
+template Texture3D Texture3D::from_data<short>(const VTKField<short>&, size_t, size_t, size_t, GLint);
+template Texture3D Texture3D::from_data<unsigned char>(const VTKField<unsigned char>&, size_t, size_t, size_t, GLint);
+
 Texture3D Texture3D::from_intarray(int* data, size_t width, size_t height, size_t depth)
 {
 }
@@ -1,20 +1,31 @@
 #include "ArcballCamera.h"
+#include "IncrementalSurface.h"
 #include "MarchingCubes.h"
 #include "MarchingCubesLUT.h"
 #include "ShaderProgram.h"
+#include "Texture.h"
 #include "WireframeBoundingBox.h"
 #include <GL/gl.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <glm/common.hpp>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/fwd.hpp>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <sstream>
+#include <thread>
+#include <tuple>
 
+#include <BrickedField.h>
 #include <VTKParser.h>
+#include <VTKTimeSeries.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -45,6 +56,42 @@ float isovalue = 1.0f;
 RenderMode render_mode = RenderMode::CPU;
 int selected_field = 0;
 
+// A path with a '*' in its file name opens a time series, one file per timestep
+fs::path data_path = "data/redseasmall.vtk";
+VTKTimeSeriesOptions series_options;
+std::unique_ptr<VTKTimeSeries> time_series;
+int timestep = 0;
+int shown_timestep = 0;
+bool robust_slider = false;
+
+// The dataset is parsed on a worker thread while the window stays responsive.
+// GL objects can only be made on the main thread, so it takes over the data
+// once the worker is done.
+std::thread load_thread;
+std::atomic<bool> load_finished(false);
+std::mutex load_mutex;
+VTKLoadProgress load_progress = {};
+VTKData loaded_data;
+std::string load_error;
+bool data_ready = false;
+// --preview N first shows every Nth sample, then loads the full grid behind it
+int preview_stride = 1;
+// --roi X Y Z W H D loads only the W x H x D grid points from (X, Y, Z)
+std::optional<VTKRegion> roi;
+// --out-of-core BUDGET_MB keeps the selected field in a brick file next to the
+// data instead of in memory, with at most BUDGET_MB of bricks resident. The
+// brick file is written the first time a field is shown. Only the CPU render
+// mode works this way, and not for time series, previews or regions.
+size_t out_of_core_budget = 0;
+std::optional<VTKBrickedFieldVariant> loaded_bricked;
+std::optional<VTKBrickedFieldVariant> bricked;
+int bricked_field = -1;
+// A field selected before it is loaded (or, out of core, before its bricks are
+// written) is parsed by the worker too; the surface of the field shown before
+// stays up until finish_loading_field() switches over. The worker only writes
+// that field of `data`, and the Fields menu waits for it.
+int loading_field = -1;
+
 glm::mat4 model = glm::mat4(1.0f);
 glm::mat4 view = glm::mat4(1.0f);
 glm::mat4 projection = glm::mat4(1.0f);
@@ -144,72 +191,162 @@ void mouse_scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     }
 }
 
-GLuint vert_VBO, normal_VBO, VAO, tricount;
+GLuint vert_VBO, normal_VBO, EBO, VAO, index_count;
 GLuint gs_VBO, gs_VAO;
 
-void create_isosurface()
+// What the isosurfaces of the selected field share. Gradients and block
+// ranges only depend on its samples, so moving the isovalue or switching the
+// render mode reuses them, and the surface is patched rather than made anew;
+// they are dropped when another field is selected or the data is replaced.
+struct FieldCache {
+    int field = -1;
+    GradientField gradients;
+    MinMaxTree ranges;
+    IncrementalSurface surface;
+};
+FieldCache field_cache;
+FieldCache loaded_field_cache;
+IndexedMesh loaded_mesh;
+float loaded_isovalue = 0.0f;
+
+void drop_field_cache()
 {
-    auto [tris, normals] = MarchingCubes::triangulate_field(data.fields[selected_field], isovalue);
-    tricount = tris.size();
+    field_cache = FieldCache();
+}
 
+// The cache of the selected field, empty if it has none yet
+FieldCache& selected_field_cache()
+{
+    if (field_cache.field != selected_field) {
+        field_cache = FieldCache();
+        field_cache.field = selected_field;
+    }
+    return field_cache;
+}
+
+bool out_of_core()
+{
+    return out_of_core_budget > 0 && !time_series;
+}
+
+// The selected field out of core, opened by the worker before it is selected
+VTKBrickedFieldVariant& selected_bricked()
+{
+    if (!bricked || bricked_field != selected_field) {
+        bricked = open_bricked(data, selected_field, out_of_core_budget);
+        bricked_field = selected_field;
+    }
+    return *bricked;
+}
+
+// Range of the selected field the isovalue slider spans
+std::pair<double, double> isovalue_range()
+{
+    if (out_of_core()) {
+        return std::visit([](const auto& field) { return std::pair<double, double>(field.min, field.max); }, selected_bricked());
+    }
+    // The 1st to 99th percentile keeps a few outliers from squeezing the useful range
+    return robust_slider ? robust_range(data.field(selected_field)) : field_range(data.field(selected_field));
+}
+
+void upload_isosurface(const IndexedMesh& mesh)
+{
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, vert_VBO);
-    glBufferData(GL_ARRAY_BUFFER, tris.size() * sizeof(glm::vec3), tris.data(), GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(glm::vec3), mesh.vertices.data(), GL_DYNAMIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
     glEnableVertexAttribArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, normal_VBO);
-    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), normals.data(), GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(glm::vec3), mesh.normals.data(), GL_DYNAMIC_DRAW);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
     glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(uint32_t), mesh.indices.data(), GL_DYNAMIC_DRAW);
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-GLuint fieldTextureID;
-GLuint normalTextureID;
-GLuint edgeTableTextureID;
-GLuint triTableTextureID;
+// Uploads only the parts of the surface the last update changed
+void patch_isosurface(const IncrementalSurface& surface)
+{
+    const IndexedMesh& mesh = surface.mesh();
+    for (const IncrementalSurface::Span& span : surface.vertex_spans()) {
+        glBindBuffer(GL_ARRAY_BUFFER, vert_VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, span.begin * sizeof(glm::vec3), span.count * sizeof(glm::vec3), &mesh.vertices[span.begin]);
+        glBindBuffer(GL_ARRAY_BUFFER, normal_VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, span.begin * sizeof(glm::vec3), span.count * sizeof(glm::vec3), &mesh.normals[span.begin]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-void create_gs_textures()
+    // The element buffer binding is part of the VAO
+    glBindVertexArray(VAO);
+    for (const IncrementalSurface::Span& span : surface.index_spans()) {
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, span.begin * sizeof(uint32_t), span.count * sizeof(uint32_t), &mesh.indices[span.begin]);
+    }
+    glBindVertexArray(0);
+}
+
+void create_isosurface()
 {
-    auto gradients = MarchingCubes::compute_gradient(data.fields[selected_field]);
-    std::vector<glm::vec3> grad_texture_data;
-    for (int k = 0; k < data.dimension.z; k++) {
-        for (int j = 0; j < data.dimension.y; j++) {
-            for (int i = 0; i < data.dimension.x; i++) {
-                grad_texture_data.push_back(gradients[i][j][k]);
-            }
-        }
+    // Out of core a brick at a time, every time, as nothing of the field is kept
+    if (out_of_core()) {
+        IndexedMesh mesh;
+        std::tie(mesh.vertices, mesh.normals) = std::visit([](const auto& field) {
+            return MarchingCubes::triangulate_bricked(field, isovalue);
+        }, selected_bricked());
+        mesh.indices.resize(mesh.vertices.size());
+        std::iota(mesh.indices.begin(), mesh.indices.end(), 0);
+        index_count = mesh.indices.size();
+        upload_isosurface(mesh);
+        return;
     }
 
-    std::vector<float> fieldData;
-    for (int k = 0; k < data.dimension.z; k++) {
-        for (int j = 0; j < data.dimension.y; j++) {
-            for (int i = 0; i < data.dimension.x; i++) {
-                fieldData.push_back(data.fields[selected_field](i, j, k));
-            }
+    // The selected field is always loaded; a field that is not is parsed by
+    // the worker before it is selected (see start_loading_field)
+    FieldCache& cache = selected_field_cache();
+    std::visit([&](auto& field) {
+        if (cache.gradients.data.empty()) {
+            cache.gradients = MarchingCubes::compute_gradient(field);
+        }
+        if (cache.ranges.empty()) {
+            cache.ranges = MinMaxTree::build(field);
         }
+        cache.surface.update(field, cache.gradients, cache.ranges, isovalue);
+    }, data.field(selected_field));
+
+    index_count = cache.surface.index_count();
+    if (cache.surface.relaid()) {
+        upload_isosurface(cache.surface.mesh());
+    } else {
+        patch_isosurface(cache.surface);
     }
+}
 
-    glGenTextures(1, &fieldTextureID);
-    glBindTexture(GL_TEXTURE_3D, fieldTextureID);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, data.dimension.x, data.dimension.y, data.dimension.z, 0, GL_RED, GL_FLOAT, fieldData.data());
-    glBindTexture(GL_TEXTURE_3D, 0);
+// The texture objects are made once in setup(); a field, and every timestep
+// of a series, is uploaded into the same ones
+GLuint fieldTextureID;
+GLuint normalTextureID;
+GLuint edgeTableTextureID;
+GLuint triTableTextureID;
 
-    glGenTextures(1, &normalTextureID);
-    glBindTexture(GL_TEXTURE_3D, normalTextureID);
+GLuint create_volume_texture()
+{
+    GLuint id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_3D, id);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB32F, data.dimension.x, data.dimension.y, data.dimension.z, 0, GL_RGB, GL_FLOAT, grad_texture_data.data());
     glBindTexture(GL_TEXTURE_3D, 0);
+    return id;
+}
+
+void create_gs_tables()
+{
+    fieldTextureID = create_volume_texture();
+    normalTextureID = create_volume_texture();
 
     // Upload the edge table texture
     glGenTextures(1, &edgeTableTextureID);
@@ -229,7 +366,25 @@ void create_gs_textures()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, 16, 256, 0, GL_RED_INTEGER, GL_INT, &TRI_TBL);
     glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void create_gs_textures()
+{
+    // The gradients are already in texture order
+    GradientField& field_gradients = selected_field_cache().gradients;
+    std::vector<float> scratch;
+    const float* fieldData = std::visit([&](auto& field) {
+        if (field_gradients.data.empty()) {
+            field_gradients = MarchingCubes::compute_gradient(field);
+        }
+        return float_samples(field, scratch);
+    }, data.field(selected_field));
 
+    glBindTexture(GL_TEXTURE_3D, fieldTextureID);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, data.dimension.x, data.dimension.y, data.dimension.z, 0, GL_RED, GL_FLOAT, fieldData);
+    glBindTexture(GL_TEXTURE_3D, normalTextureID);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB32F, data.dimension.x, data.dimension.y, data.dimension.z, 0, GL_RGB, GL_FLOAT, field_gradients.data.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
 }
 
 void create_gs_lattice()
@@ -261,35 +416,213 @@ void create_stuff_for_current_field()
     }
 }
 
-void setup()
+void create_bounding_box()
 {
-    data = VTKParser::from_file("data/redseasmall.vtk");
+    float L = (data.dimension.x - 1) * data.spacing.x;
+    float H = (data.dimension.y - 1) * data.spacing.y;
+    float W = (data.dimension.z - 1) * data.spacing.z;
 
+    bounding_box = std::make_unique<WireframeBoundingBox>(L, H, W);
+    set_projection_matrix(WINDOW_WIDTH, WINDOW_HEIGHT);
+}
 
-    // upload the vertices to the GPU
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &vert_VBO);
-    glGenBuffers(1, &normal_VBO);
+void start_loading(int stride)
+{
+    load_finished = false;
+    load_error.clear();
+
+    auto on_progress = [](const VTKLoadProgress& progress) {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        load_progress = progress;
+    };
+
+    load_thread = std::thread([on_progress, stride, field = selected_field]() {
+        try {
+            VTKData loaded;
+            if (data_path.filename().string().find('*') != std::string::npos) {
+                series_options.parse.progress = on_progress;
+                series_options.parse.region = roi;
+                time_series = std::make_unique<VTKTimeSeries>(VTKTimeSeries::expand_pattern(data_path), series_options);
+                loaded = time_series->get(0);
+            } else if (out_of_core_budget > 0) {
+                // Only the header and index are read; the first field shown has
+                // its bricks written here, off the main thread
+                VTKParseOptions options;
+                options.progress = on_progress;
+                loaded = open_index(data_path, options);
+                loaded_bricked = open_bricked(loaded, field, out_of_core_budget);
+            } else {
+                // Fields are parsed on demand, when they are first selected;
+                // the first one shown is parsed here, off the main thread
+                VTKParseOptions options;
+                options.lazy = true;
+                options.stride = stride;
+                options.region = roi;
+                options.progress = on_progress;
+                loaded = VTKParser::from_file(data_path, options);
+                loaded.field(field);
+            }
+            loaded_data = std::move(loaded);
+        } catch (const std::exception& e) {
+            load_error = e.what();
+        }
+        load_finished = true;
+    });
+}
 
-    create_isosurface();
+void start_loading_field(int field)
+{
+    load_finished = false;
+    load_error.clear();
+    loading_field = field;
+    loaded_isovalue = isovalue;
+
+    load_thread = std::thread([field, iso = loaded_isovalue, robust = robust_slider]() {
+        try {
+            if (out_of_core()) {
+                loaded_bricked = open_bricked(data, field, out_of_core_budget);
+            } else {
+                // Triangulated while it is parsed, as the first field is
+                loaded_field_cache = FieldCache();
+                loaded_field_cache.field = field;
+                loaded_mesh = MarchingCubes::triangulate_streaming(data, field, iso, loaded_field_cache.gradients, loaded_field_cache.ranges);
+                if (robust) {
+                    // The slider's percentiles take a pass of their own
+                    field_stats(data.field(field));
+                }
+            }
+        } catch (const std::exception& e) {
+            load_error = e.what();
+        }
+        load_finished = true;
+    });
+}
 
-    glGenVertexArrays(1, &gs_VAO);
-    glGenBuffers(1, &gs_VBO);
+void finish_loading_field()
+{
+    load_thread.join();
+    const int field = loading_field;
+    loading_field = -1;
+    if (!load_error.empty()) {
+        std::cerr << "Failed to load field " << data.field_index[field].name << ": " << load_error << "\n";
+        return;
+    }
+
+    selected_field = field;
+    if (out_of_core()) {
+        bricked = std::move(loaded_bricked);
+        loaded_bricked.reset();
+        bricked_field = field;
+        create_isosurface();
+        return;
+    }
+
+    field_cache = std::move(loaded_field_cache);
+    loaded_field_cache = FieldCache();
+    // The worker's surface is still right unless the isovalue moved meanwhile
+    if (render_mode == RenderMode::CPU && isovalue == loaded_isovalue) {
+        index_count = loaded_mesh.indices.size();
+        upload_isosurface(loaded_mesh);
+    } else {
+        create_stuff_for_current_field();
+    }
+    loaded_mesh = IndexedMesh();
+}
+
+void select_field(int field)
+{
+    const bool loaded = out_of_core() ? bricked && bricked_field == field : data.is_loaded(field);
+    if (!loaded) {
+        start_loading_field(field);
+        return;
+    }
+    selected_field = field;
+    create_stuff_for_current_field();
+}
+
+void finish_loading()
+{
+    load_thread.join();
+    if (!load_error.empty()) {
+        std::cerr << "Failed to load " << data_path << ": " << load_error << "\n";
+        return;
+    }
+    data = std::move(loaded_data);
+    drop_field_cache();
+    bricked = std::move(loaded_bricked);
+    loaded_bricked.reset();
+    bricked_field = selected_field;
+    const bool preview = data.loader && data.loader->options().stride > 1;
 
-    create_gs_lattice();
-    create_gs_textures();
+    create_isosurface();
+    if (!out_of_core()) {
+        create_gs_lattice();
+        create_gs_textures();
+    }
 
     std::cout << "Dimensions: [" 
         << data.dimension.x * data.spacing.x << ", "
         << data.dimension.y * data.spacing.y << ", "
         << data.dimension.z * data.spacing.z << "]\n";
 
-    // Build the bounding box
-    float L = (data.dimension.x - 1) * data.spacing.x;
-    float H = (data.dimension.y - 1) * data.spacing.y;
-    float W = (data.dimension.z - 1) * data.spacing.z;
+    create_bounding_box();
+    data_ready = true;
 
-    bounding_box = std::make_unique<WireframeBoundingBox>(L, H, W);
+    if (preview) {
+        start_loading(1);
+    }
+}
+
+// Progress of the worker
+void show_loading()
+{
+    VTKLoadProgress progress;
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        progress = load_progress;
+    }
+
+    // The grid is known once the header is read, so the outline can show up early
+    if (!bounding_box && progress.dimension.x > 0) {
+        data.dimension = progress.dimension;
+        data.spacing = progress.spacing;
+        create_bounding_box();
+    }
+
+    ImGui::Begin("Loading");
+    ImGui::Text("%s", data_path.filename().c_str());
+    if (!load_thread.joinable()) {
+        ImGui::Text("Failed: %s", load_error.c_str());
+    } else {
+        if (loading_field >= 0) {
+            ImGui::Text("Loading field %s", data.field_index[loading_field].name.c_str());
+        } else if (data_ready) {
+            ImGui::Text("Showing a preview, loading the full grid");
+        }
+        float fraction = progress.bytes_total > 0 ? float(progress.bytes_done) / float(progress.bytes_total) : 0.0f;
+        if (progress.bytes_total == 0) {
+            ImGui::Text("Reading header");
+        } else if (progress.field == VTKLoadProgress::INDEXING) {
+            ImGui::Text("Indexing");
+        } else {
+            ImGui::Text("Field %zu", progress.field + 1);
+        }
+        ImGui::ProgressBar(fraction);
+    }
+    ImGui::End();
+}
+
+void setup()
+{
+    // upload the vertices to the GPU
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &vert_VBO);
+    glGenBuffers(1, &normal_VBO);
+    glGenBuffers(1, &EBO);
+
+    glGenVertexArrays(1, &gs_VAO);
+    glGenBuffers(1, &gs_VBO);
+    create_gs_tables();
 
     wireframe_shader = ShaderProgram::from_files(
             "Isosurface/Shaders/Wireframe.vert",
@@ -307,8 +640,9 @@ void setup()
             "Isosurface/Shaders/MarchingCubes.geom"
         );
 
-    set_projection_matrix(WINDOW_WIDTH, WINDOW_HEIGHT);
-
+    // Time series and fields out of core are always loaded at full resolution
+    bool series = data_path.filename().string().find('*') != std::string::npos;
+    start_loading(series || out_of_core_budget > 0 ? 1 : preview_stride);
 }
 
 void draw()
@@ -324,7 +658,12 @@ void draw()
     wireframe_shader.set("model", model);
     wireframe_shader.set("view", view);
     wireframe_shader.set("projection", projection);
-    bounding_box->draw();
+    if (bounding_box) {
+        bounding_box->draw();
+    }
+    if (!data_ready) {
+        return;
+    }
 
     if (render_mode == RenderMode::CPU) {
         auto view_pos = camera.position();
@@ -336,7 +675,7 @@ void draw()
         phong_shader.set("viewPos", view_pos);
         glBindVertexArray(VAO);
         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        glDrawArrays(GL_TRIANGLES, 0, tricount);
+        glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, 0);
     } else {
         auto view_pos = camera.position();
         auto dim_vec = glm::vec3(data.dimension.x, data.dimension.y, data.dimension.z);
@@ -369,8 +708,38 @@ void draw()
     }
 }
 
-int main(int, char**) 
+// [path or pattern] [--ahead N] [--behind N] [--budget-mb N] [--preview N]
+//     [--roi X Y Z W H D] [--out-of-core BUDGET_MB]
+void parse_arguments(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--ahead" && i + 1 < argc) {
+            series_options.ahead = std::stoul(argv[++i]);
+        } else if (arg == "--behind" && i + 1 < argc) {
+            series_options.behind = std::stoul(argv[++i]);
+        } else if (arg == "--budget-mb" && i + 1 < argc) {
+            series_options.memory_budget = std::stoul(argv[++i]) << 20;
+        } else if (arg == "--preview" && i + 1 < argc) {
+            preview_stride = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--roi" && i + 6 < argc) {
+            VTKRegion region;
+            region.begin = { std::stoi(argv[i + 1]), std::stoi(argv[i + 2]), std::stoi(argv[i + 3]) };
+            region.size = { std::stoi(argv[i + 4]), std::stoi(argv[i + 5]), std::stoi(argv[i + 6]) };
+            roi = region;
+            i += 6;
+        } else if (arg == "--out-of-core" && i + 1 < argc) {
+            out_of_core_budget = std::stoul(argv[++i]) << 20;
+        } else {
+            data_path = arg;
+        }
+    }
+}
+
+int main(int argc, char** argv) 
 {
+    parse_arguments(argc, argv);
+
     glfwInit();
 
     glfwWindowHint(GLFW_SCALE_FRAMEBUFFER, GLFW_FALSE);
@@ -412,14 +781,6 @@ int main(int, char**)
     glfwSwapInterval(0);
 
     setup();
-    float L = (data.dimension.x - 1) * data.spacing.x;
-    float H = (data.dimension.y - 1) * data.spacing.y;
-    float W = (data.dimension.z - 1) * data.spacing.z;
-
-    std::vector<std::string> field_names;
-    for (auto& field : data.fields) {
-        field_names.push_back(field.name);
-    }
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
@@ -430,13 +791,26 @@ int main(int, char**)
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-        if (ImGui::BeginMainMenuBar()) {
+        // The worker's data replaces what is shown (nothing, or a preview) once it is done
+        if (load_thread.joinable() && load_finished) {
+            if (loading_field >= 0) {
+                finish_loading_field();
+            } else {
+                finish_loading();
+            }
+        }
+        if (!data_ready || load_thread.joinable()) {
+            show_loading();
+        }
+
+        if (data_ready && ImGui::BeginMainMenuBar()) {
             if (ImGui::BeginMenu("Render Mode")) {
                 if (ImGui::MenuItem("CPU", nullptr, render_mode == RenderMode::CPU)) {
                     render_mode = RenderMode::CPU;
                     create_stuff_for_current_field();
                 }
-                if (ImGui::MenuItem("GPU", nullptr, render_mode == RenderMode::GPU)) {
+                // The GPU needs the whole field as a texture
+                if (ImGui::MenuItem("GPU", nullptr, render_mode == RenderMode::GPU, !out_of_core())) {
                     render_mode = RenderMode::GPU;
                     create_stuff_for_current_field();
                 }
@@ -444,10 +818,9 @@ int main(int, char**)
             }
             
             if (ImGui::BeginMenu("Fields")) {
-                for (int i = 0; i < field_names.size(); i++) {
-                    if (ImGui::MenuItem(field_names[i].c_str(), nullptr, selected_field == i)) {
-                        selected_field = i;
-                        create_stuff_for_current_field();
+                for (int i = 0; i < data.field_index.size(); i++) {
+                    if (ImGui::MenuItem(data.field_index[i].name.c_str(), nullptr, selected_field == i, !load_thread.joinable())) {
+                        select_field(i);
                     }
                 }
                 ImGui::EndMenu();
@@ -456,9 +829,33 @@ int main(int, char**)
             ImGui::EndMainMenuBar();
         }
 
-        {
+        if (data_ready && time_series) {
+            ImGui::Begin("Time");
+            if (ImGui::SliderInt("Timestep", &timestep, 0, int(time_series->size()) - 1)) {
+                time_series->set_current(timestep);
+            }
+            // The last timestep stays up until the prefetcher has the new one
+            if (timestep != shown_timestep && !load_thread.joinable()) {
+                if (auto next = time_series->try_get(timestep)) {
+                    data = std::move(*next);
+                    drop_field_cache();
+                    shown_timestep = timestep;
+                    selected_field = std::min(selected_field, int(data.fields.size()) - 1);
+                    create_stuff_for_current_field();
+                } else {
+                    ImGui::Text("Loading %s...", time_series->path(timestep).filename().c_str());
+                }
+            }
+            ImGui::End();
+        }
+
+        if (data_ready) {
             ImGui::Begin("Isovalue");
-            if(ImGui::SliderFloat("Isovalue", &isovalue, data.fields[selected_field].min_val(), data.fields[selected_field].max_val())) {
+            if (!out_of_core()) {
+                ImGui::Checkbox("Robust range", &robust_slider);
+            }
+            auto [field_min, field_max] = isovalue_range();
+            if(ImGui::SliderFloat("Isovalue", &isovalue, field_min, field_max)) {
                 if (render_mode == RenderMode::CPU) {
                     create_isosurface();
                 }
@@ -475,6 +872,11 @@ int main(int, char**)
         calculateFPS(window);
     }
 
+    // Closed while loading: the parse can't be interrupted, so wait it out
+    if (load_thread.joinable()) {
+        load_thread.join();
+    }
+
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
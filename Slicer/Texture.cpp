@@ -1,5 +1,6 @@
 #include "Texture.h"
 
+#include <algorithm>
 #include <vector>
 
 Texture1D::Texture1D() {}
@@ -43,16 +44,19 @@ Texture3D::Texture3D() {}
 Texture3D::Texture3D(GLuint id, int L, int W, int D)
     : m_id(id), m_L(L), m_W(W), m_D(D) {}
 
-Texture3D Texture3D::from_data(VTKField<double> data, size_t width, size_t height, size_t depth)
+template<typename T>
+Texture3D Texture3D::from_data(const VTKField<T>& data, size_t width, size_t height, size_t depth, double range_min, double range_max)
 {
     std::vector<float> fdata;
+    fdata.reserve(width * height * depth);
     for (size_t z = 0; z < depth; z++)
     {
         for (size_t y = 0; y < height; y++)
         {
             for (size_t x = 0; x < width; x++)
             {
-                float normalized = (data(x, y, z) - data.min_val()) / (data.max_val() - data.min_val());
+                float normalized = (float(data(x, y, z)) - float(range_min)) / (float(range_max) - float(range_min));
+                normalized = std::clamp(normalized, 0.0f, 1.0f);
                 fdata.push_back(normalized);
             }
         }
@@ -75,12 +79,30 @@ Texture3D Texture3D::from_data(VTKField<double> data, size_t width, size_t heigh
     return Texture3D(id, width, height, depth);
 }
 
+Texture3D Texture3D::from_data(const VTKFieldVariant& data, size_t width, size_t height, size_t depth, double range_min, double range_max)
+{
+    return std::visit([&](const auto& field) { return from_data(field, width, height, depth, range_min, range_max); }, data);
+}
+
+template Texture3D Texture3D::from_data<double>(const VTKField<double>&, size_t, size_t, size_t, double, double);
+template Texture3D Texture3D::from_data<float>(const VTKField<float>&, size_t, size_t, size_t, double, double);
+template Texture3D Texture3D::from_data<short>(const VTKField<short>&, size_t, size_t, size_t, double, double);
+template Texture3D Texture3D::from_data<unsigned char>(const VTKField<unsigned char>&, size_t, size_t, size_t, double, double);
+
 void Texture3D::bind()
 {
     glActiveTexture(GL_TEXTURE0 + 1);
     glBindTexture(GL_TEXTURE_3D, m_id);
 }
 
+void Texture3D::destroy()
+{
+    if (m_id != 0) {
+        glDeleteTextures(1, &m_id);
+        m_id = 0;
+    }
+}
+
 GLuint Texture3D::id() const 
 { 
     return m_id; 
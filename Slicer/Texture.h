@@ -2,8 +2,23 @@
 
 #include <GL/gl.h>
 #include <glm/glm.hpp>
+#include <type_traits>
+#include <vector>
 #include <VTKParser.h>
 
+// Samples of a field as floats, ready for a GL_FLOAT upload. Float fields are
+// used in place, every other sample type is converted into `scratch`.
+template<typename T>
+const float* float_samples(const VTKField<T>& field, std::vector<float>& scratch)
+{
+    if constexpr (std::is_same_v<T, float>) {
+        return field.data.data();
+    } else {
+        scratch.assign(field.data.begin(), field.data.end());
+        return scratch.data();
+    }
+}
+
 class Texture1D {
 public:
     Texture1D();
@@ -21,13 +36,18 @@ public:
     Texture3D();
     Texture3D(GLuint id, int L, int W, int D);
 
-    static Texture3D from_data(VTKField<double> data, size_t width, size_t height, size_t depth);
+    // Samples are normalized so that [range_min, range_max] maps to [0, 1], and clamped
+    template<typename T>
+    static Texture3D from_data(const VTKField<T>& data, size_t width, size_t height, size_t depth, double range_min, double range_max);
+    static Texture3D from_data(const VTKFieldVariant& data, size_t width, size_t height, size_t depth, double range_min, double range_max);
     void bind();
+    // Deletes the GL texture, if any; the texture is empty afterwards
+    void destroy();
     GLuint id() const;
     Dimension dimension() const;
 
 private:
-    GLuint m_id;
+    GLuint m_id = 0;
     int m_L, m_W, m_D;
 };
 
@@ -5,15 +5,22 @@
 #include <GL/gl.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/quaternion_common.hpp>
 #include <glm/fwd.hpp>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <thread>
 
+#include <BrickedField.h>
 #include <VTKParser.h>
+#include <VTKTimeSeries.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -49,8 +56,45 @@ enum class SlicePlaneType {
 } slice_plane = SlicePlaneType::XY;
 RenderMode render_mode = RenderMode::CPU;
 int selected_field = 0;
+
+// A path with a '*' in its file name opens a time series, one file per timestep
+fs::path data_path = "data/redseasmall.vtk";
+VTKTimeSeriesOptions series_options;
+std::unique_ptr<VTKTimeSeries> time_series;
+int timestep = 0;
+int shown_timestep = 0;
+bool robust_colormap = false;
 float plane_ratio = 0.5f;
 
+// The dataset is parsed on a worker thread while the window stays responsive.
+// GL objects can only be made on the main thread, so it takes over the data
+// once the worker is done.
+std::thread load_thread;
+std::atomic<bool> load_finished(false);
+std::mutex load_mutex;
+VTKLoadProgress load_progress = {};
+VTKData loaded_data;
+std::string load_error;
+bool data_ready = false;
+// --preview N first shows every Nth sample, then loads the full grid behind it
+int preview_stride = 1;
+// --roi X Y Z W H D loads only the W x H x D grid points from (X, Y, Z)
+std::optional<VTKRegion> roi;
+// --out-of-core BUDGET_MB keeps the selected field in a brick file next to the
+// data instead of in memory, with at most BUDGET_MB of bricks resident. The
+// brick file is written the first time a field is shown, and the plane reads
+// only the two slices it lies between. Only the CPU render mode works this
+// way, and not for time series, previews or regions.
+size_t out_of_core_budget = 0;
+std::optional<VTKBrickedFieldVariant> loaded_bricked;
+std::optional<VTKBrickedFieldVariant> bricked;
+int bricked_field = -1;
+// A field selected before it is loaded (or, out of core, before its bricks are
+// written) is parsed by the worker too; the plane keeps the colors of the
+// field shown before until finish_loading_field() switches over. The worker
+// only writes that field of `data`, and the Fields menu waits for it.
+int loading_field = -1;
+
 glm::mat4 model = glm::mat4(1.0f);
 glm::mat4 view = glm::mat4(1.0f);
 glm::mat4 projection = glm::mat4(1.0f);
@@ -212,13 +256,50 @@ public:
         glDeleteBuffers(1, &m_EBO);
     }
 
-    void setColorData(VTKField<double>& data)
+    // [range_min, range_max] is spread over the colormap
+    void setColorData(VTKFieldVariant& field, std::pair<double, double> range)
+    {
+        std::visit([&](auto& f) { setColorData(f, range.first, range.second); }, field);
+    }
+
+    // The part of the field the plane is colored from: the two slices it lies
+    // between, along the axis it slides on
+    VTKRegion slab() const
+    {
+        float pos = lerp(0, m_sliding_length, m_ratio);
+        int p1 = int(pos / m_sliding_spacing);
+        int p2 = int(std::min(size_t(p1) + 1, m_sliding_dimension - 1));
+
+        VTKRegion region = { {0, 0, 0}, data.dimension };
+        switch (m_type) {
+            case SlicePlaneType::XY:
+                region.begin.z = p1;
+                region.size.z = p2 - p1 + 1;
+                break;
+            case SlicePlaneType::XZ:
+                region.begin.y = p1;
+                region.size.y = p2 - p1 + 1;
+                break;
+            case SlicePlaneType::YZ:
+                region.begin.x = p1;
+                region.size.x = p2 - p1 + 1;
+                break;
+        }
+        return region;
+    }
+
+    // `data` holds the field from slice `first` on along the sliding axis,
+    // which is all of it unless it was read as the plane's slab()
+    template<typename T>
+    void setColorData(VTKField<T>& data, double range_min, double range_max, size_t first = 0)
     {
         float pos = lerp(0, m_sliding_length, m_ratio);
         size_t p1 = pos / m_sliding_spacing;
         size_t p2 = std::min(p1+1, m_sliding_dimension - 1);
 
         float residue = ((pos / m_sliding_spacing) - p1) / m_sliding_spacing;
+        p1 -= first;
+        p2 -= first;
 
         glm::vec3 color1(0.0f, 0.0f, 1.0f);
         glm::vec3 color2(1.0f, 0.0f, 0.0f);
@@ -232,7 +313,7 @@ public:
                 {
                     for (int i = 0; i < data.dimension.x; i++) {
                         float d = lerp(data(i, j, p1),data(i, j, p2), residue);
-                        float t = (d - data.min_val()) / (data.max_val() - data.min_val());
+                        float t = std::clamp(float((d - range_min) / (range_max - range_min)), 0.0f, 1.0f);
                         auto c = glm::vec3(lerp(color1.r, color2.r, t), lerp(color1.g, color2.g, t), lerp(color1.b, color2.b, t));
                         color_buffer.push_back(c.r);
                         color_buffer.push_back(c.g);
@@ -246,7 +327,7 @@ public:
                 {
                     for (int i = 0; i < data.dimension.x; i++) {
                         float d = lerp(data(i, p1, j),data(i, p2, j), residue);
-                        float t = (d - data.min_val()) / (data.max_val() - data.min_val());
+                        float t = std::clamp(float((d - range_min) / (range_max - range_min)), 0.0f, 1.0f);
                         auto c = glm::vec3(lerp(color1.r, color2.r, t), lerp(color1.g, color2.g, t), lerp(color1.b, color2.b, t));
                         color_buffer.push_back(c.r);
                         color_buffer.push_back(c.g);
@@ -260,7 +341,7 @@ public:
                 {
                     for (int i = 0; i < data.dimension.y; i++) {
                         float d = lerp(data(p1, i, j),data(p2, i, j), residue);
-                        float t = (d - data.min_val()) / (data.max_val() - data.min_val());
+                        float t = std::clamp(float((d - range_min) / (range_max - range_min)), 0.0f, 1.0f);
                         auto c = glm::vec3(lerp(color1.r, color2.r, t), lerp(color1.g, color2.g, t), lerp(color1.b, color2.b, t));
                         color_buffer.push_back(c.r);
                         color_buffer.push_back(c.g);
@@ -566,37 +647,264 @@ void mouse_scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     }
 }
 
-void create_stuff() {
-    slicing_plane->setColorData(data.fields[selected_field]);
-    color_map = Texture1D::from_colormap(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f,0.0f, 0.0f));
+bool out_of_core()
+{
+    return out_of_core_budget > 0 && !time_series;
+}
+
+// The selected field out of core, opened by the worker before it is selected
+VTKBrickedFieldVariant& selected_bricked()
+{
+    if (!bricked || bricked_field != selected_field) {
+        bricked = open_bricked(data, selected_field, out_of_core_budget);
+        bricked_field = selected_field;
+    }
+    return *bricked;
+}
+
+// Range of the selected field that the colormap spans
+std::pair<double, double> colormap_range()
+{
+    if (out_of_core()) {
+        return std::visit([](const auto& field) { return std::pair<double, double>(field.min, field.max); }, selected_bricked());
+    }
+    // The 1st to 99th percentile keeps a few outliers from washing out the colors
+    return robust_colormap ? robust_range(data.field(selected_field)) : field_range(data.field(selected_field));
+}
+
+// Colors the CPU slicing plane from the selected field
+void color_slicing_plane()
+{
+    if (!out_of_core()) {
+        slicing_plane->setColorData(data.field(selected_field), colormap_range());
+        return;
+    }
+
+    const VTKRegion slab = slicing_plane->slab();
+    const auto [range_min, range_max] = colormap_range();
+    const size_t first = slicing_plane->type() == SlicePlaneType::XY ? slab.begin.z
+        : slicing_plane->type() == SlicePlaneType::XZ ? slab.begin.y : slab.begin.x;
+    std::visit([&](const auto& field) {
+        auto samples = field.read_box(slab.begin, slab.size);
+        slicing_plane->setColorData(samples, range_min, range_max, first);
+    }, selected_bricked());
+}
+
+// Uploads the selected field for the GPU render mode, in place of the last
+// one. The colormap never changes, so it is only made once in setup().
+void create_data_texture()
+{
+    auto [range_min, range_max] = colormap_range();
+    data_tex.destroy();
     data_tex = Texture3D::from_data(
-            data.fields[selected_field],
+            data.field(selected_field),
             data.dimension.x,
             data.dimension.y,
-            data.dimension.z
+            data.dimension.z,
+            range_min,
+            range_max
         );
 }
 
-void setup()
+void create_stuff() {
+    color_slicing_plane();
+    if (!out_of_core()) {
+        create_data_texture();
+    }
+}
+
+void create_bounding_box()
+{
+    float L = (data.dimension.x - 1) * data.spacing.x;
+    float H = (data.dimension.y - 1) * data.spacing.y;
+    float W = (data.dimension.z - 1) * data.spacing.z;
+
+    bounding_box = std::make_unique<WireframeBoundingBox>(L, H, W);
+    set_projection_matrix(WINDOW_WIDTH, WINDOW_HEIGHT);
+}
+
+void start_loading(int stride)
+{
+    load_finished = false;
+    load_error.clear();
+
+    auto on_progress = [](const VTKLoadProgress& progress) {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        load_progress = progress;
+    };
+
+    load_thread = std::thread([on_progress, stride, field = selected_field]() {
+        try {
+            VTKData loaded;
+            if (data_path.filename().string().find('*') != std::string::npos) {
+                series_options.parse.progress = on_progress;
+                series_options.parse.region = roi;
+                time_series = std::make_unique<VTKTimeSeries>(VTKTimeSeries::expand_pattern(data_path), series_options);
+                loaded = time_series->get(0);
+            } else if (out_of_core_budget > 0) {
+                // Only the header and index are read; the first field shown has
+                // its bricks written here, off the main thread
+                VTKParseOptions options;
+                options.progress = on_progress;
+                loaded = open_index(data_path, options);
+                loaded_bricked = open_bricked(loaded, field, out_of_core_budget);
+            } else {
+                // Fields are parsed on demand, when they are first selected;
+                // the first one shown is parsed here, off the main thread
+                VTKParseOptions options;
+                options.lazy = true;
+                options.stride = stride;
+                options.region = roi;
+                options.progress = on_progress;
+                loaded = VTKParser::from_file(data_path, options);
+                loaded.field(field);
+            }
+            loaded_data = std::move(loaded);
+        } catch (const std::exception& e) {
+            load_error = e.what();
+        }
+        load_finished = true;
+    });
+}
+
+void start_loading_field(int field)
+{
+    load_finished = false;
+    load_error.clear();
+    loading_field = field;
+
+    load_thread = std::thread([field, robust = robust_colormap]() {
+        try {
+            if (out_of_core()) {
+                loaded_bricked = open_bricked(data, field, out_of_core_budget);
+            } else if (robust) {
+                // The colormap's percentiles take a pass of their own
+                field_stats(data.field(field));
+            } else {
+                data.field(field);
+            }
+        } catch (const std::exception& e) {
+            load_error = e.what();
+        }
+        load_finished = true;
+    });
+}
+
+void finish_loading_field()
+{
+    load_thread.join();
+    const int field = loading_field;
+    loading_field = -1;
+    if (!load_error.empty()) {
+        std::cerr << "Failed to load field " << data.field_index[field].name << ": " << load_error << "\n";
+        return;
+    }
+
+    selected_field = field;
+    if (out_of_core()) {
+        bricked = std::move(loaded_bricked);
+        loaded_bricked.reset();
+        bricked_field = field;
+    }
+    create_stuff();
+}
+
+void select_field(int field)
 {
-    data = VTKParser::from_file("data/redseasmall.vtk");
+    const bool loaded = out_of_core() ? bricked && bricked_field == field : data.is_loaded(field);
+    if (!loaded) {
+        start_loading_field(field);
+        return;
+    }
+    selected_field = field;
+    create_stuff();
+}
+
+void finish_loading()
+{
+    load_thread.join();
+    if (!load_error.empty()) {
+        std::cerr << "Failed to load " << data_path << ": " << load_error << "\n";
+        return;
+    }
+    data = std::move(loaded_data);
+    bricked = std::move(loaded_bricked);
+    loaded_bricked.reset();
+    bricked_field = selected_field;
+    const bool preview = data.loader && data.loader->options().stride > 1;
+
     std::cout << "Dimensions: [" 
         << data.dimension.x * data.spacing.x << ", "
         << data.dimension.y * data.spacing.y << ", "
         << data.dimension.z * data.spacing.z << "]\n";
 
-    // Build the bounding box
+    create_bounding_box();
+
     float L = (data.dimension.x - 1) * data.spacing.x;
     float H = (data.dimension.y - 1) * data.spacing.y;
     float W = (data.dimension.z - 1) * data.spacing.z;
 
-    bounding_box = std::make_unique<WireframeBoundingBox>(L, H, W);
+    // Keeps the plane the preview was sliced along
+    SlicePlaneType type = slicing_plane ? slicing_plane->type() : SlicePlaneType::XY;
+    slicing_plane = std::make_unique<SlicingPlane>(type, L, H, W);
+    slicing_plane->m_ratio = plane_ratio;
+    color_slicing_plane();
+
+    slicing_plane_2 = std::make_unique<SlicingPlaneGPU>(type, L, H, W);
+    slicing_plane_2->m_ratio = plane_ratio;
+
+    if (!out_of_core()) {
+        create_data_texture();
+    }
+
+    data_ready = true;
+
+    if (preview) {
+        start_loading(1);
+    }
+}
+
+// Progress of the worker
+void show_loading()
+{
+    VTKLoadProgress progress;
+    {
+        std::lock_guard<std::mutex> lock(load_mutex);
+        progress = load_progress;
+    }
 
-    slicing_plane = std::make_unique<SlicingPlane>(SlicePlaneType::XY, L, H, W);
-    slicing_plane->setColorData(data.fields[selected_field]);
+    // The grid is known once the header is read, so the outline can show up early
+    if (!bounding_box && progress.dimension.x > 0) {
+        data.dimension = progress.dimension;
+        data.spacing = progress.spacing;
+        create_bounding_box();
+    }
 
-    slicing_plane_2 = std::make_unique<SlicingPlaneGPU>(SlicePlaneType::XY, L, H, W);
+    ImGui::Begin("Loading");
+    ImGui::Text("%s", data_path.filename().c_str());
+    if (!load_thread.joinable()) {
+        ImGui::Text("Failed: %s", load_error.c_str());
+    } else {
+        if (loading_field >= 0) {
+            ImGui::Text("Loading field %s", data.field_index[loading_field].name.c_str());
+        } else if (data_ready) {
+            ImGui::Text("Showing a preview, loading the full grid");
+        }
+        float fraction = progress.bytes_total > 0 ? float(progress.bytes_done) / float(progress.bytes_total) : 0.0f;
+        if (progress.bytes_total == 0) {
+            ImGui::Text("Reading header");
+        } else if (progress.field == VTKLoadProgress::INDEXING) {
+            ImGui::Text("Indexing");
+        } else {
+            ImGui::Text("Field %zu", progress.field + 1);
+        }
+        ImGui::ProgressBar(fraction);
+    }
+    ImGui::End();
+}
 
+void setup()
+{
     wireframe_shader = ShaderProgram::from_files(
             "Slicer/Shaders/Wireframe.vert",
             "Slicer/Shaders/Wireframe.frag"
@@ -612,14 +920,9 @@ void setup()
 
     color_map = Texture1D::from_colormap(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f,0.0f, 0.0f));
 
-    data_tex = Texture3D::from_data(
-            data.fields[selected_field],
-            data.dimension.x,
-            data.dimension.y,
-            data.dimension.z
-        );
-
-    set_projection_matrix(WINDOW_WIDTH, WINDOW_HEIGHT);
+    // Time series and fields out of core are always loaded at full resolution
+    bool series = data_path.filename().string().find('*') != std::string::npos;
+    start_loading(series || out_of_core_budget > 0 ? 1 : preview_stride);
 }
 
 void draw()
@@ -631,7 +934,12 @@ void draw()
     wireframe_shader.set("model", model);
     wireframe_shader.set("view", view);
     wireframe_shader.set("projection", projection);
-    bounding_box->draw();
+    if (bounding_box) {
+        bounding_box->draw();
+    }
+    if (!data_ready) {
+        return;
+    }
 
     if (render_mode == RenderMode::CPU) {
         model = slicing_plane->getModelMatrix();
@@ -649,8 +957,9 @@ void draw()
         sliceplanetex_shader.set("view", view);
         sliceplanetex_shader.set("projection", projection);
         sliceplanetex_shader.set("t", slicing_plane_2->m_ratio);
-        sliceplanetex_shader.set("data_min", data.fields[selected_field].min_val());
-        sliceplanetex_shader.set("data_max", data.fields[selected_field].max_val());
+        auto [data_min, data_max] = colormap_range();
+        sliceplanetex_shader.set("data_min", data_min);
+        sliceplanetex_shader.set("data_max", data_max);
         sliceplanetex_shader.set("colourmapTexture", 0);
         sliceplanetex_shader.set("dataTexture", 1);
         sliceplanetex_shader.set("planeType", (int)slicing_plane_2->type());
@@ -658,8 +967,38 @@ void draw()
     }
 }
 
-int main(int, char**) 
+// [path or pattern] [--ahead N] [--behind N] [--budget-mb N] [--preview N]
+//     [--roi X Y Z W H D] [--out-of-core BUDGET_MB]
+void parse_arguments(int argc, char** argv)
 {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--ahead" && i + 1 < argc) {
+            series_options.ahead = std::stoul(argv[++i]);
+        } else if (arg == "--behind" && i + 1 < argc) {
+            series_options.behind = std::stoul(argv[++i]);
+        } else if (arg == "--budget-mb" && i + 1 < argc) {
+            series_options.memory_budget = std::stoul(argv[++i]) << 20;
+        } else if (arg == "--preview" && i + 1 < argc) {
+            preview_stride = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--roi" && i + 6 < argc) {
+            VTKRegion region;
+            region.begin = { std::stoi(argv[i + 1]), std::stoi(argv[i + 2]), std::stoi(argv[i + 3]) };
+            region.size = { std::stoi(argv[i + 4]), std::stoi(argv[i + 5]), std::stoi(argv[i + 6]) };
+            roi = region;
+            i += 6;
+        } else if (arg == "--out-of-core" && i + 1 < argc) {
+            out_of_core_budget = std::stoul(argv[++i]) << 20;
+        } else {
+            data_path = arg;
+        }
+    }
+}
+
+int main(int argc, char** argv) 
+{
+    parse_arguments(argc, argv);
+
     glfwInit();
 
     glfwWindowHint(GLFW_SCALE_FRAMEBUFFER, GLFW_FALSE);
@@ -701,14 +1040,6 @@ int main(int, char**)
     glfwSwapInterval(0);
 
     setup();
-    float L = (data.dimension.x - 1) * data.spacing.x;
-    float H = (data.dimension.y - 1) * data.spacing.y;
-    float W = (data.dimension.z - 1) * data.spacing.z;
-
-    std::vector<std::string> field_names;
-    for (auto& field : data.fields) {
-        field_names.push_back(field.name);
-    }
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
@@ -718,15 +1049,28 @@ int main(int, char**)
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
-        
-        if (ImGui::BeginMainMenuBar()) {
+
+        // The worker's data replaces what is shown (nothing, or a preview) once it is done
+        if (load_thread.joinable() && load_finished) {
+            if (loading_field >= 0) {
+                finish_loading_field();
+            } else {
+                finish_loading();
+            }
+        }
+        if (!data_ready || load_thread.joinable()) {
+            show_loading();
+        }
+
+        if (data_ready && ImGui::BeginMainMenuBar()) {
             if (ImGui::BeginMenu("Render Mode")) {
                 if (ImGui::MenuItem("CPU", nullptr, render_mode == RenderMode::CPU)) {
                     render_mode = RenderMode::CPU;
                     slicing_plane->m_ratio = plane_ratio;
                     create_stuff();
                 }
-                if (ImGui::MenuItem("GPU", nullptr, render_mode == RenderMode::GPU)) {
+                // The GPU needs the whole field as a texture
+                if (ImGui::MenuItem("GPU", nullptr, render_mode == RenderMode::GPU, !out_of_core())) {
                     render_mode = RenderMode::GPU;
                     slicing_plane_2->m_ratio = plane_ratio;
                     create_stuff();
@@ -735,10 +1079,9 @@ int main(int, char**)
             }
             
             if (ImGui::BeginMenu("Fields")) {
-                for (int i = 0; i < field_names.size(); i++) {
-                    if (ImGui::MenuItem(field_names[i].c_str(), nullptr, selected_field == i)) {
-                        selected_field = i;
-                        create_stuff();
+                for (int i = 0; i < data.field_index.size(); i++) {
+                    if (ImGui::MenuItem(data.field_index[i].name.c_str(), nullptr, selected_field == i, !load_thread.joinable())) {
+                        select_field(i);
                     }
                 }
                 ImGui::EndMenu();
@@ -746,12 +1089,35 @@ int main(int, char**)
 
             ImGui::EndMainMenuBar();
         }
-        {
+        if (data_ready && time_series) {
+            ImGui::Begin("Time");
+            if (ImGui::SliderInt("Timestep", &timestep, 0, int(time_series->size()) - 1)) {
+                time_series->set_current(timestep);
+            }
+            // The last timestep stays up until the prefetcher has the new one
+            if (timestep != shown_timestep && !load_thread.joinable()) {
+                if (auto next = time_series->try_get(timestep)) {
+                    data = std::move(*next);
+                    shown_timestep = timestep;
+                    selected_field = std::min(selected_field, int(data.fields.size()) - 1);
+                    create_stuff();
+                } else {
+                    ImGui::Text("Loading %s...", time_series->path(timestep).filename().c_str());
+                }
+            }
+            ImGui::End();
+        }
+
+        if (data_ready) {
+            float L = (data.dimension.x - 1) * data.spacing.x;
+            float H = (data.dimension.y - 1) * data.spacing.y;
+            float W = (data.dimension.z - 1) * data.spacing.z;
+
             ImGui::Begin("Slicing");
 
             if(ImGui::RadioButton("XY", slicing_plane->type() == SlicePlaneType::XY)) {
                 slicing_plane = std::make_unique<SlicingPlane>(SlicePlaneType::XY, L, H, W);
-                slicing_plane->setColorData(data.fields[selected_field]);
+                color_slicing_plane();
 
                 slicing_plane_2 = std::make_unique<SlicingPlaneGPU>(SlicePlaneType::XY, L, H, W);
 
@@ -762,7 +1128,7 @@ int main(int, char**)
 
             if(ImGui::RadioButton("YZ", slicing_plane->type() == SlicePlaneType::YZ)) {
                 slicing_plane = std::make_unique<SlicingPlane>(SlicePlaneType::YZ, L, H, W);
-                slicing_plane->setColorData(data.fields[selected_field]);
+                color_slicing_plane();
 
                 slicing_plane_2 = std::make_unique<SlicingPlaneGPU>(SlicePlaneType::YZ, L, H, W);
 
@@ -773,7 +1139,7 @@ int main(int, char**)
 
             if(ImGui::RadioButton("XZ", slicing_plane->type() == SlicePlaneType::XZ)) {
                 slicing_plane = std::make_unique<SlicingPlane>(SlicePlaneType::XZ, L, H, W);
-                slicing_plane->setColorData(data.fields[selected_field]);
+                color_slicing_plane();
 
                 slicing_plane_2 = std::make_unique<SlicingPlaneGPU>(SlicePlaneType::XZ, L, H, W);
 
@@ -781,10 +1147,14 @@ int main(int, char**)
                 slicing_plane_2->m_ratio = plane_ratio;
             }
 
+            if (!out_of_core() && ImGui::Checkbox("Robust colormap range", &robust_colormap)) {
+                create_stuff();
+            }
+
             if(ImGui::SliderFloat("t", &plane_ratio, 0.0f, 1.0f)) {
                 if (render_mode == RenderMode::CPU) {
                     slicing_plane->m_ratio = plane_ratio;
-                    slicing_plane->setColorData(data.fields[selected_field]);
+                    color_slicing_plane();
                 } else {
                     slicing_plane_2->m_ratio = plane_ratio;
                 }
@@ -802,6 +1172,11 @@ int main(int, char**)
         calculateFPS(window);
     }
 
+    // Closed while loading: the parse can't be interrupted, so wait it out
+    if (load_thread.joinable()) {
+        load_thread.join();
+    }
+
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
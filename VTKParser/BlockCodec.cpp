@@ -0,0 +1,368 @@
+#include "BlockCodec.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+enum BlockMode : uint8_t {
+    BLOCK_RAW = 0,       // Samples as they are in memory
+    BLOCK_SHUFFLE = 1,   // RLE(shuffle(xor delta of the sample bits))
+    BLOCK_QUANTIZED = 2, // base, step, RLE(shuffle(zigzag delta of the quantized samples))
+};
+
+template<typename T>
+using Bits = std::conditional_t<sizeof(T) == 1, uint8_t,
+             std::conditional_t<sizeof(T) == 2, uint16_t,
+             std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+
+static void corrupt()
+{
+    throw std::runtime_error("Corrupt compressed block.");
+}
+
+template<typename U>
+static void put(std::vector<char>& out, U value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(U));
+}
+
+template<typename U>
+static U get(const char*& in, const char* end)
+{
+    if (size_t(end - in) < sizeof(U)) {
+        corrupt();
+    }
+    U value;
+    std::memcpy(&value, in, sizeof(U));
+    in += sizeof(U);
+    return value;
+}
+
+// Control byte c < 128 is followed by c + 1 literal bytes, c >= 128 by one
+// byte repeated c - 125 times.
+static void rle_encode(const uint8_t* in, size_t n, std::vector<char>& out)
+{
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 130 && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            out.push_back(char(run + 125));
+            out.push_back(char(in[i]));
+            i += run;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < n && i - start < 128) {
+            if (i + 2 < n && in[i] == in[i + 1] && in[i] == in[i + 2]) {
+                break;
+            }
+            i++;
+        }
+        out.push_back(char(i - start - 1));
+        out.insert(out.end(), in + start, in + i);
+    }
+}
+
+static void rle_decode(const char* in, const char* end, uint8_t* out, size_t n)
+{
+    size_t i = 0;
+    while (in < end) {
+        uint8_t c = uint8_t(*in++);
+        if (c < 128) {
+            size_t len = size_t(c) + 1;
+            if (size_t(end - in) < len || n - i < len) {
+                corrupt();
+            }
+            std::memcpy(out + i, in, len);
+            in += len;
+            i += len;
+        } else {
+            size_t len = size_t(c) - 125;
+            if (in == end || n - i < len) {
+                corrupt();
+            }
+            std::memset(out + i, uint8_t(*in++), len);
+            i += len;
+        }
+    }
+    if (i != n) {
+        corrupt();
+    }
+}
+
+// Plane k holds byte k (least significant first) of every word.
+template<typename U>
+static void shuffle_rle(const std::vector<U>& words, std::vector<char>& out)
+{
+    const size_t n = words.size();
+    std::vector<uint8_t> planes(n * sizeof(U));
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = 0; k < sizeof(U); k++) {
+            planes[k * n + i] = uint8_t(words[i] >> (8 * k));
+        }
+    }
+    rle_encode(planes.data(), planes.size(), out);
+}
+
+template<typename U>
+static void rle_unshuffle(const char* in, const char* end, U* words, size_t n)
+{
+    std::vector<uint8_t> planes(n * sizeof(U));
+    rle_decode(in, end, planes.data(), planes.size());
+    for (size_t i = 0; i < n; i++) {
+        U w = 0;
+        for (size_t k = 0; k < sizeof(U); k++) {
+            w |= U(planes[k * n + i]) << (8 * k);
+        }
+        words[i] = w;
+    }
+}
+
+static uint32_t zigzag(int32_t d)
+{
+    return (uint32_t(d) << 1) ^ uint32_t(d >> 31);
+}
+
+static int32_t unzigzag(uint32_t z)
+{
+    return int32_t(z >> 1) ^ -int32_t(z & 1);
+}
+
+template<typename T>
+static T dequantize(double base, double step, int64_t q)
+{
+    return T(base + double(q) * step);
+}
+
+// Fails if the block has non-finite samples, spans too many steps, or a
+// sample would not round trip within the error bound.
+template<typename T>
+static bool encode_quantized(const T* in, size_t n, double error_bound, std::vector<char>& out)
+{
+    T lo = in[0];
+    T hi = in[0];
+    for (size_t i = 0; i < n; i++) {
+        if (!std::isfinite(in[i])) {
+            return false;
+        }
+        lo = std::min(lo, in[i]);
+        hi = std::max(hi, in[i]);
+    }
+
+    const double base = lo;
+    const double step = 2.0 * error_bound;
+    if (!((double(hi) - base) / step < double(INT32_MAX))) {
+        return false;
+    }
+
+    std::vector<uint32_t> words(n);
+    int64_t prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        int64_t q = std::llround((double(in[i]) - base) / step);
+        if (!(std::abs(double(dequantize<T>(base, step, q)) - double(in[i])) <= error_bound)) {
+            return false;
+        }
+        words[i] = zigzag(int32_t(q - prev));
+        prev = q;
+    }
+
+    out.push_back(char(BLOCK_QUANTIZED));
+    put(out, base);
+    put(out, step);
+    shuffle_rle(words, out);
+    return true;
+}
+
+template<typename T>
+static std::vector<char> encode_block(const T* in, size_t n, double error_bound)
+{
+    using U = Bits<T>;
+    const size_t raw_size = 1 + n * sizeof(T);
+    std::vector<char> out;
+
+    if constexpr (std::is_floating_point_v<T>) {
+        if (error_bound > 0 && encode_quantized(in, n, error_bound, out) && out.size() < raw_size) {
+            return out;
+        }
+        out.clear();
+    }
+
+    std::vector<U> words(n);
+    U prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        U w;
+        std::memcpy(&w, in + i, sizeof(U));
+        words[i] = w ^ prev;
+        prev = w;
+    }
+    out.push_back(char(BLOCK_SHUFFLE));
+    shuffle_rle(words, out);
+
+    if (out.size() >= raw_size) {
+        out.assign(1, char(BLOCK_RAW));
+        const char* bytes = reinterpret_cast<const char*>(in);
+        out.insert(out.end(), bytes, bytes + n * sizeof(T));
+    }
+    return out;
+}
+
+template<typename T>
+static void decode_block(const char* in, const char* end, T* out, size_t n)
+{
+    using U = Bits<T>;
+    uint8_t mode = get<uint8_t>(in, end);
+
+    switch (mode) {
+        case BLOCK_RAW:
+            if (size_t(end - in) != n * sizeof(T)) {
+                corrupt();
+            }
+            std::memcpy(out, in, n * sizeof(T));
+            break;
+        case BLOCK_SHUFFLE: {
+            std::vector<U> words(n);
+            rle_unshuffle(in, end, words.data(), n);
+            U prev = 0;
+            for (size_t i = 0; i < n; i++) {
+                prev ^= words[i];
+                std::memcpy(out + i, &prev, sizeof(U));
+            }
+            break;
+        }
+        case BLOCK_QUANTIZED: {
+            if constexpr (!std::is_floating_point_v<T>) {
+                corrupt();
+            }
+            double base = get<double>(in, end);
+            double step = get<double>(in, end);
+            std::vector<uint32_t> words(n);
+            rle_unshuffle(in, end, words.data(), n);
+            int64_t q = 0;
+            for (size_t i = 0; i < n; i++) {
+                q += unzigzag(words[i]);
+                out[i] = dequantize<T>(base, step, q);
+            }
+            break;
+        }
+        default:
+            corrupt();
+    }
+}
+
+// Stream layout: sample count, block count, the end offset of every block
+// within the payload, then the blocks back to back.
+template<typename T>
+std::vector<char> encode_samples(const T* samples, size_t count, double error_bound)
+{
+    const size_t blocks = (count + CODEC_BLOCK_VALUES - 1) / CODEC_BLOCK_VALUES;
+    std::vector<std::vector<char>> encoded(blocks);
+    parallel_for(blocks, [&](size_t b) {
+        size_t first = b * CODEC_BLOCK_VALUES;
+        size_t n = std::min(CODEC_BLOCK_VALUES, count - first);
+        encoded[b] = encode_block(samples + first, n, error_bound);
+    });
+
+    std::vector<char> out;
+    put<uint64_t>(out, count);
+    put<uint64_t>(out, blocks);
+    uint64_t offset = 0;
+    for (const auto& block : encoded) {
+        offset += block.size();
+        put<uint64_t>(out, offset);
+    }
+    out.reserve(out.size() + offset);
+    for (const auto& block : encoded) {
+        out.insert(out.end(), block.begin(), block.end());
+    }
+    return out;
+}
+
+// Where the blocks of a stream are, after its header has been checked
+struct BlockTable {
+    const char* table;
+    const char* payload;
+    size_t payload_size;
+    size_t blocks;
+};
+
+static BlockTable read_block_table(const char* in, size_t size, size_t count)
+{
+    const char* end = in + size;
+    uint64_t stored_count = get<uint64_t>(in, end);
+    uint64_t blocks = get<uint64_t>(in, end);
+    if (stored_count != count || blocks != (count + CODEC_BLOCK_VALUES - 1) / CODEC_BLOCK_VALUES ||
+        blocks > size_t(end - in) / sizeof(uint64_t)) {
+        corrupt();
+    }
+
+    const char* payload = in + blocks * sizeof(uint64_t);
+    return BlockTable { in, payload, size_t(end - payload), size_t(blocks) };
+}
+
+template<typename T>
+static void decode_table_block(const BlockTable& t, size_t b, size_t count, T* out)
+{
+    uint64_t begin = 0;
+    uint64_t finish;
+    if (b > 0) {
+        std::memcpy(&begin, t.table + (b - 1) * sizeof(uint64_t), sizeof(uint64_t));
+    }
+    std::memcpy(&finish, t.table + b * sizeof(uint64_t), sizeof(uint64_t));
+    if (begin > finish || finish > t.payload_size) {
+        corrupt();
+    }
+
+    size_t first = b * CODEC_BLOCK_VALUES;
+    size_t n = std::min(CODEC_BLOCK_VALUES, count - first);
+    decode_block(t.payload + begin, t.payload + finish, out, n);
+}
+
+template<typename T>
+void decode_samples(const char* in, size_t size, T* out, size_t count)
+{
+    const BlockTable table = read_block_table(in, size, count);
+    parallel_for(table.blocks, [&](size_t b) {
+        decode_table_block(table, b, count, out + b * CODEC_BLOCK_VALUES);
+    });
+}
+
+template<typename T>
+void decode_sample_range(const char* in, size_t size, size_t count, size_t first, size_t n, T* out)
+{
+    if (n == 0) {
+        return;
+    }
+    if (first + n > count) {
+        corrupt();
+    }
+
+    const BlockTable table = read_block_table(in, size, count);
+    std::vector<T> block(CODEC_BLOCK_VALUES);
+    for (size_t b = first / CODEC_BLOCK_VALUES; b * CODEC_BLOCK_VALUES < first + n; b++) {
+        const size_t block_first = b * CODEC_BLOCK_VALUES;
+        decode_table_block(table, b, count, block.data());
+
+        const size_t begin = std::max(first, block_first);
+        const size_t end = std::min(first + n, std::min(count, block_first + CODEC_BLOCK_VALUES));
+        std::copy(block.data() + (begin - block_first), block.data() + (end - block_first), out + (begin - first));
+    }
+}
+
+#define INSTANTIATE_BLOCK_CODEC(T) \
+    template std::vector<char> encode_samples<T>(const T*, size_t, double); \
+    template void decode_samples<T>(const char*, size_t, T*, size_t); \
+    template void decode_sample_range<T>(const char*, size_t, size_t, size_t, size_t, T*);
+
+INSTANTIATE_BLOCK_CODEC(double)
+INSTANTIATE_BLOCK_CODEC(float)
+INSTANTIATE_BLOCK_CODEC(short)
+INSTANTIATE_BLOCK_CODEC(unsigned char)
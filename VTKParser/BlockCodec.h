@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Compression for stored sample arrays. Samples are split into fixed size
+// blocks that encode and decode independently, so both run in parallel.
+//
+// Each block is XOR-delta encoded against the previous sample, byte-plane
+// shuffled (all first bytes, then all second bytes, ...) and run-length
+// encoded. Smooth fields leave the high planes mostly zero, which RLE folds
+// away. With error_bound > 0, floating point blocks are first quantized to
+// integer steps of 2 * error_bound, so every decoded sample is within
+// error_bound of the original. Blocks that would not shrink are kept raw.
+
+// Number of samples per block.
+static constexpr size_t CODEC_BLOCK_VALUES = 1 << 16;
+
+template<typename T>
+std::vector<char> encode_samples(const T* samples, size_t count, double error_bound);
+
+// Decodes a stream written by encode_samples() for `count` samples into `out`.
+// Throws std::runtime_error if the stream is malformed.
+template<typename T>
+void decode_samples(const char* in, size_t size, T* out, size_t count);
+
+// Decodes samples [first, first + n) of such a stream into `out`. Only the
+// blocks overlapping the range are decoded, on the calling thread.
+template<typename T>
+void decode_sample_range(const char* in, size_t size, size_t count, size_t first, size_t n, T* out);
@@ -0,0 +1,351 @@
+#include "BrickedField.h"
+#include "Parallel.h"
+#include "VTKCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char BRICK_MAGIC[8] = {'S', 'F', 'V', 'B', 'R', 'I', 'C', 'K'};
+static constexpr uint32_t BRICK_VERSION = 1;
+static constexpr uint32_t BRICK_BYTE_ORDER = 0x01020304;
+// Bricks start on a page boundary, so reading one touches as few pages as possible
+static constexpr size_t BRICK_DATA_ALIGNMENT = 4096;
+
+struct BrickHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint32_t sample_size;
+    int32_t brick_edge;
+    int32_t dimension[3];
+    float spacing[3];
+    double min;
+    double max;
+    char name[64];
+};
+
+static int brick_count(int samples)
+{
+    return (samples + BRICK_EDGE - 1) / BRICK_EDGE;
+}
+
+template<typename T>
+BrickedField<T>::Store::~Store()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+template<typename T>
+BrickedField<T>::BrickedField(std::shared_ptr<Store> store)
+    : m_store(std::move(store)) {}
+
+template<typename T>
+fs::path BrickedField<T>::path_for(const fs::path& source, size_t i)
+{
+    fs::path path = source;
+    path += "." + std::to_string(i) + ".bricks";
+    return path;
+}
+
+template<typename T>
+void BrickedField<T>::write(const fs::path& path, const fs::path& source, const std::string& name,
+        Dimension dimension, Spacing spacing, const SlabReader& read_slab)
+{
+    BrickHeader header = {};
+    std::memcpy(header.magic, BRICK_MAGIC, sizeof(BRICK_MAGIC));
+    header.version = BRICK_VERSION;
+    header.byte_order = BRICK_BYTE_ORDER;
+    if (!VTKCache::source_stamp(source, header.source_size, header.source_mtime)) {
+        throw std::runtime_error("Could not stat " + source.string());
+    }
+    header.sample_size = sizeof(T);
+    header.brick_edge = BRICK_EDGE;
+    header.dimension[0] = dimension.x;
+    header.dimension[1] = dimension.y;
+    header.dimension[2] = dimension.z;
+    header.spacing[0] = spacing.x;
+    header.spacing[1] = spacing.y;
+    header.spacing[2] = spacing.z;
+    std::strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+
+    // Written next to the brick file and renamed, so a reader never sees a partial file
+    fs::path tmp_path = path;
+    tmp_path += ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Could not open " + tmp_path.string() + " for writing.");
+    }
+    static const char padding[BRICK_DATA_ALIGNMENT] = {};
+    out.write(padding, BRICK_DATA_ALIGNMENT);
+
+    const int bx_count = brick_count(dimension.x);
+    const int by_count = brick_count(dimension.y);
+    const size_t slice_values = size_t(dimension.x) * dimension.y;
+    std::vector<T> slab(slice_values * BRICK_EDGE);
+    std::vector<T> bricks(size_t(bx_count) * by_count * BRICK_VALUES);
+    T field_min = std::numeric_limits<T>::max();
+    T field_max = std::numeric_limits<T>::lowest();
+
+    for (int z0 = 0; z0 < dimension.z; z0 += BRICK_EDGE) {
+        const int slices = std::min(BRICK_EDGE, dimension.z - z0);
+        T slab_min, slab_max;
+        read_slab(z0, slices, slab.data(), slab_min, slab_max);
+        field_min = std::min(field_min, slab_min);
+        field_max = std::max(field_max, slab_max);
+
+        // Bricks on the upper faces repeat the last sample of the field to fill up
+        parallel_for(size_t(bx_count) * by_count, [&](size_t b) {
+            const int x0 = int(b % bx_count) * BRICK_EDGE;
+            const int y0 = int(b / bx_count) * BRICK_EDGE;
+            T* brick = bricks.data() + b * BRICK_VALUES;
+            for (int z = 0; z < BRICK_EDGE; z++) {
+                const int sz = std::min(z, slices - 1);
+                for (int y = 0; y < BRICK_EDGE; y++) {
+                    const int sy = std::min(y0 + y, dimension.y - 1);
+                    const T* row = slab.data() + sz * slice_values + size_t(sy) * dimension.x;
+                    T* brick_row = brick + (size_t(z) * BRICK_EDGE + y) * BRICK_EDGE;
+                    for (int x = 0; x < BRICK_EDGE; x++) {
+                        brick_row[x] = row[std::min(x0 + x, dimension.x - 1)];
+                    }
+                }
+            }
+        });
+        out.write(reinterpret_cast<const char*>(bricks.data()), bricks.size() * sizeof(T));
+    }
+
+    header.min = double(field_min);
+    header.max = double(field_max);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+
+    std::error_code ec;
+    if (!out) {
+        fs::remove(tmp_path, ec);
+        throw std::runtime_error("Could not write " + tmp_path.string());
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        throw std::runtime_error("Could not write " + path.string());
+    }
+}
+
+template<typename T>
+std::optional<BrickedField<T>> BrickedField<T>::open(const fs::path& path, const fs::path& source, size_t budget)
+{
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!VTKCache::source_stamp(source, source_size, source_mtime)) {
+        return std::nullopt;
+    }
+
+    auto store = std::make_shared<Store>();
+    store->fd = ::open(path.c_str(), O_RDONLY);
+    if (store->fd < 0) {
+        return std::nullopt;
+    }
+
+    BrickHeader header;
+    struct stat st;
+    if (pread(store->fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) || fstat(store->fd, &st) != 0) {
+        return std::nullopt;
+    }
+    if (std::memcmp(header.magic, BRICK_MAGIC, sizeof(BRICK_MAGIC)) != 0 ||
+        header.version != BRICK_VERSION ||
+        header.byte_order != BRICK_BYTE_ORDER ||
+        header.source_size != source_size ||
+        header.source_mtime != source_mtime ||
+        header.sample_size != sizeof(T) ||
+        header.brick_edge != BRICK_EDGE) {
+        return std::nullopt;
+    }
+
+    store->data_offset = BRICK_DATA_ALIGNMENT;
+    store->bricks[0] = brick_count(header.dimension[0]);
+    store->bricks[1] = brick_count(header.dimension[1]);
+    store->bricks[2] = brick_count(header.dimension[2]);
+    store->budget = budget;
+    const size_t brick_total = size_t(store->bricks[0]) * store->bricks[1] * store->bricks[2];
+    if (size_t(st.st_size) != store->data_offset + brick_total * BRICK_VALUES * sizeof(T)) {
+        return std::nullopt;
+    }
+
+    BrickedField field(std::move(store));
+    field.name = std::string(header.name, strnlen(header.name, sizeof(header.name)));
+    field.dimension = {header.dimension[0], header.dimension[1], header.dimension[2]};
+    field.spacing = {header.spacing[0], header.spacing[1], header.spacing[2]};
+    field.min = T(header.min);
+    field.max = T(header.max);
+    return field;
+}
+
+template<typename T>
+std::shared_ptr<const std::vector<T>> BrickedField<T>::brick(int bx, int by, int bz) const
+{
+    Store& store = *m_store;
+    const size_t index = (size_t(bz) * store.bricks[1] + by) * store.bricks[0] + bx;
+    {
+        std::lock_guard<std::mutex> lock(store.mutex);
+        auto it = store.resident.find(index);
+        if (it != store.resident.end()) {
+            store.lru.splice(store.lru.begin(), store.lru, it->second.second);
+            return it->second.first;
+        }
+    }
+
+    // Read without the lock, so other threads keep finding their resident
+    // bricks. Two threads may read the same brick; the second copy is dropped.
+    auto samples = std::make_shared<std::vector<T>>(BRICK_VALUES);
+    char* out = reinterpret_cast<char*>(samples->data());
+    size_t bytes = BRICK_VALUES * sizeof(T);
+    off_t offset = off_t(store.data_offset + index * bytes);
+    while (bytes > 0) {
+        ssize_t n = pread(store.fd, out, bytes, offset);
+        if (n <= 0) {
+            throw std::runtime_error("Failed to read a brick of field " + name);
+        }
+        out += n;
+        bytes -= size_t(n);
+        offset += n;
+    }
+
+    std::lock_guard<std::mutex> lock(store.mutex);
+    auto it = store.resident.find(index);
+    if (it != store.resident.end()) {
+        return it->second.first;
+    }
+    store.lru.push_front(index);
+    store.resident.emplace(index, std::make_pair(samples, store.lru.begin()));
+    store.resident_bytes += BRICK_VALUES * sizeof(T);
+
+    // Bricks still in use elsewhere stay alive through their shared_ptr
+    while (store.resident_bytes > store.budget && store.lru.size() > 1) {
+        store.resident.erase(store.lru.back());
+        store.lru.pop_back();
+        store.resident_bytes -= BRICK_VALUES * sizeof(T);
+    }
+    return samples;
+}
+
+template<typename T>
+T BrickedField<T>::operator()(int x, int y, int z) const
+{
+    auto samples = brick(x / BRICK_EDGE, y / BRICK_EDGE, z / BRICK_EDGE);
+    return (*samples)[(size_t(z % BRICK_EDGE) * BRICK_EDGE + y % BRICK_EDGE) * BRICK_EDGE + x % BRICK_EDGE];
+}
+
+template<typename T>
+VTKField<T> BrickedField<T>::read_box(Dimension begin, Dimension size) const
+{
+    if (begin.x < 0 || begin.y < 0 || begin.z < 0 || size.x <= 0 || size.y <= 0 || size.z <= 0 ||
+        begin.x + size.x > dimension.x || begin.y + size.y > dimension.y || begin.z + size.z > dimension.z) {
+        throw std::out_of_range("Box is outside of field " + name);
+    }
+
+    VTKField<T> box(name, size, spacing);
+    box.min = std::numeric_limits<T>::max();
+    box.max = std::numeric_limits<T>::lowest();
+    const Dimension end = {begin.x + size.x, begin.y + size.y, begin.z + size.z};
+
+    for (int bz = begin.z / BRICK_EDGE; bz * BRICK_EDGE < end.z; bz++) {
+        for (int by = begin.y / BRICK_EDGE; by * BRICK_EDGE < end.y; by++) {
+            for (int bx = begin.x / BRICK_EDGE; bx * BRICK_EDGE < end.x; bx++) {
+                auto samples = brick(bx, by, bz);
+
+                // Part of the box inside this brick, in field coordinates
+                const int x0 = std::max(begin.x, bx * BRICK_EDGE);
+                const int x1 = std::min(end.x, (bx + 1) * BRICK_EDGE);
+                const int y0 = std::max(begin.y, by * BRICK_EDGE);
+                const int y1 = std::min(end.y, (by + 1) * BRICK_EDGE);
+                const int z0 = std::max(begin.z, bz * BRICK_EDGE);
+                const int z1 = std::min(end.z, (bz + 1) * BRICK_EDGE);
+
+                for (int z = z0; z < z1; z++) {
+                    for (int y = y0; y < y1; y++) {
+                        const T* in = samples->data() +
+                            (size_t(z - bz * BRICK_EDGE) * BRICK_EDGE + (y - by * BRICK_EDGE)) * BRICK_EDGE + (x0 - bx * BRICK_EDGE);
+                        T* out = &box(x0 - begin.x, y - begin.y, z - begin.z);
+                        for (int x = 0; x < x1 - x0; x++) {
+                            out[x] = in[x];
+                            box.min = std::min(box.min, in[x]);
+                            box.max = std::max(box.max, in[x]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return box;
+}
+
+template<typename T>
+size_t BrickedField<T>::resident_bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_store->mutex);
+    return m_store->resident_bytes;
+}
+
+template<typename T>
+static BrickedField<T> open_bricked_as(VTKData& data, size_t i, size_t budget)
+{
+    const fs::path& source = data.loader->path();
+    const fs::path path = BrickedField<T>::path_for(source, i);
+    if (auto field = BrickedField<T>::open(path, source, budget)) {
+        return std::move(*field);
+    }
+
+    BrickedField<T>::write(path, source, data.field_index[i].name, data.dimension, data.spacing,
+            [&](int z, int slices, T* out, T& out_min, T& out_max) {
+                data.loader->read_slab(data, i, z, slices, out, out_min, out_max);
+            });
+    if (auto field = BrickedField<T>::open(path, source, budget)) {
+        return std::move(*field);
+    }
+    throw std::runtime_error("Could not open " + path.string());
+}
+
+VTKData open_index(const fs::path& path, VTKParseOptions options)
+{
+    options.lazy = true;
+    options.cache = false;
+    options.stride = 1;
+    options.region.reset();
+    return VTKParser::from_file(path, options);
+}
+
+VTKBrickedFieldVariant open_bricked(VTKData& data, size_t i, size_t budget)
+{
+    if (!data.loader) {
+        throw std::runtime_error("Field " + data.field_index[i].name + " can only be opened out of core from a file opened with open_index.");
+    }
+
+    switch (VTKParser::storage_index(data.field_index[i].type, data.loader->options().storage)) {
+        case 0:
+            return open_bricked_as<double>(data, i, budget);
+        case 1:
+            return open_bricked_as<float>(data, i, budget);
+        case 2:
+            return open_bricked_as<short>(data, i, budget);
+        default:
+            return open_bricked_as<unsigned char>(data, i, budget);
+    }
+}
+
+#define INSTANTIATE_BRICKED_FIELD(T) \
+    template class BrickedField<T>;
+
+INSTANTIATE_BRICKED_FIELD(double)
+INSTANTIATE_BRICKED_FIELD(float)
+INSTANTIATE_BRICKED_FIELD(short)
+INSTANTIATE_BRICKED_FIELD(unsigned char)
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "VTKParser.h"
+
+// Edge length, in samples, of the cubic bricks of a BrickedField
+static constexpr int BRICK_EDGE = 32;
+static constexpr size_t BRICK_VALUES = size_t(BRICK_EDGE) * BRICK_EDGE * BRICK_EDGE;
+
+// A field kept out of core, for volumes larger than memory. The samples are
+// stored in a file as BRICK_EDGE^3 bricks, so any small box of the field is
+// in a few contiguous reads. Bricks are read in on demand and at most `budget`
+// bytes of them stay resident; the least recently used brick goes first.
+//
+// Copies share the open file and the resident bricks. Any number of threads
+// may read a field at once.
+template<typename T>
+class BrickedField {
+public:
+    std::string name;
+    Dimension dimension;
+    Spacing spacing;
+    T min, max;
+
+    // Fills `out` with the samples of z-slices [z, z + slices), x varying fastest
+    using SlabReader = std::function<void(int z, int slices, T* out, T& out_min, T& out_max)>;
+
+    // Brick file of the i-th field of `source`, next to it
+    static fs::path path_for(const fs::path& source, size_t i);
+
+    // Writes a brick file for a field of `source`. read_slab is called for one
+    // slab of BRICK_EDGE slices after the other, so only one slab of samples
+    // is in memory at a time.
+    static void write(const fs::path& path, const fs::path& source, const std::string& name,
+            Dimension dimension, Spacing spacing, const SlabReader& read_slab);
+
+    // Opens a brick file, unless it is missing, holds another sample type or
+    // was written for another version of `source`.
+    static std::optional<BrickedField> open(const fs::path& path, const fs::path& source, size_t budget);
+
+    // One sample. Looks up its brick for every call; use read_box for more.
+    T operator()(int x, int y, int z) const;
+
+    // Copies the box [begin, begin + size) into an in-memory field, reading
+    // each brick it overlaps once. A box one sample thick is a slice.
+    VTKField<T> read_box(Dimension begin, Dimension size) const;
+
+    size_t resident_bytes() const;
+
+private:
+    struct Store;
+    explicit BrickedField(std::shared_ptr<Store> store);
+
+    std::shared_ptr<const std::vector<T>> brick(int bx, int by, int bz) const;
+
+    std::shared_ptr<Store> m_store;
+};
+
+template<typename T>
+struct BrickedField<T>::Store {
+    int fd = -1;
+    size_t data_offset = 0;
+    int bricks[3] = {0, 0, 0};
+    size_t budget = 0;
+
+    // Resident bricks by index, most recently used at the front of `lru`
+    std::mutex mutex;
+    std::list<size_t> lru;
+    std::unordered_map<size_t, std::pair<std::shared_ptr<const std::vector<T>>, std::list<size_t>::iterator>> resident;
+    size_t resident_bytes = 0;
+
+    ~Store();
+};
+
+using VTKBrickedFieldVariant = std::variant<BrickedField<double>, BrickedField<float>, BrickedField<short>, BrickedField<unsigned char>>;
+
+// Reads only the header and field index of a file, for open_bricked. The
+// field cache is never used: a VTKData from it has no parser to read slabs
+// with, and a compressed cache decodes every field into memory. Every field
+// is opened at full resolution, so stride and region are ignored.
+VTKData open_index(const fs::path& path, VTKParseOptions options = {});
+
+// Opens the i-th field of a VTKData from open_index out of core, stored as the
+// sample type VTKParseOptions::storage selects. The field's brick file is
+// written first if there is none for the current source file; the field is
+// never loaded into memory as a whole. At most `budget` bytes of bricks are
+// kept resident.
+VTKBrickedFieldVariant open_bricked(VTKData& data, size_t i, size_t budget);
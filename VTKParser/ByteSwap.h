@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VTK_HAS_SSE2 1
+#endif
+
+inline bool host_is_little_endian()
+{
+    const uint16_t probe = 1;
+    uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+inline uint16_t byteswap(uint16_t v)
+{
+    return uint16_t((v >> 8) | (v << 8));
+}
+
+inline uint32_t byteswap(uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0x0000ff00u) | ((v << 8) & 0x00ff0000u) | (v << 24);
+}
+
+inline uint64_t byteswap(uint64_t v)
+{
+    return (uint64_t(byteswap(uint32_t(v))) << 32) | byteswap(uint32_t(v >> 32));
+}
+
+#ifdef VTK_HAS_SSE2
+// Swap the bytes inside every 16 bit lane, then reverse the lanes of each 32/64 bit word.
+inline __m128i byteswap_epi32(__m128i v)
+{
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+inline __m128i byteswap_epi64(__m128i v)
+{
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+#endif
+
+// Reads one possibly unaligned value, swapping its bytes if asked to.
+template<typename T>
+inline T load_value(const char* in, bool swap)
+{
+    T v;
+    if constexpr (sizeof(T) == 1) {
+        std::memcpy(&v, in, 1);
+    } else {
+        using Bits = std::conditional_t<sizeof(T) == 2, uint16_t, std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>;
+        Bits raw;
+        std::memcpy(&raw, in, sizeof(raw));
+        if (swap) {
+            raw = byteswap(raw);
+        }
+        std::memcpy(&v, &raw, sizeof(v));
+    }
+    return v;
+}
+
+// Converts `count` packed Src values into Dst, swapping bytes if asked to, and
+// reduces min/max in the same pass. The common float/double cases use SSE2.
+template<typename Src, typename Dst>
+void convert_minmax(const char* in, Dst* out, size_t count, bool swap, Dst& out_min, Dst& out_max)
+{
+    Dst vmin = std::numeric_limits<Dst>::max();
+    Dst vmax = std::numeric_limits<Dst>::lowest();
+    size_t i = 0;
+
+#ifdef VTK_HAS_SSE2
+    if constexpr (std::is_same_v<Src, double> && std::is_same_v<Dst, double>) {
+        __m128d mn = _mm_set1_pd(vmin);
+        __m128d mx = _mm_set1_pd(vmax);
+        for (; i + 2 <= count; i += 2) {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * sizeof(double)));
+            if (swap) {
+                raw = byteswap_epi64(raw);
+            }
+            __m128d v = _mm_castsi128_pd(raw);
+            _mm_storeu_pd(out + i, v);
+            mn = _mm_min_pd(mn, v);
+            mx = _mm_max_pd(mx, v);
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, mn);
+        vmin = std::min(lanes[0], lanes[1]);
+        _mm_storeu_pd(lanes, mx);
+        vmax = std::max(lanes[0], lanes[1]);
+    } else if constexpr (std::is_same_v<Src, float> && (std::is_same_v<Dst, float> || std::is_same_v<Dst, double>)) {
+        __m128 mn = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128 mx = _mm_set1_ps(std::numeric_limits<float>::lowest());
+        for (; i + 4 <= count; i += 4) {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * sizeof(float)));
+            if (swap) {
+                raw = byteswap_epi32(raw);
+            }
+            __m128 v = _mm_castsi128_ps(raw);
+            if constexpr (std::is_same_v<Dst, float>) {
+                _mm_storeu_ps(out + i, v);
+            } else {
+                _mm_storeu_pd(out + i, _mm_cvtps_pd(v));
+                _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+            }
+            mn = _mm_min_ps(mn, v);
+            mx = _mm_max_ps(mx, v);
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, mn);
+        vmin = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+        _mm_storeu_ps(lanes, mx);
+        vmax = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    }
+#endif
+
+    for (; i < count; i++) {
+        Dst v = Dst(load_value<Src>(in + i * sizeof(Src), swap));
+        out[i] = v;
+        vmin = std::min(vmin, v);
+        vmax = std::max(vmax, v);
+    }
+
+    out_min = vmin;
+    out_max = vmax;
+}
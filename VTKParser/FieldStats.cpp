@@ -0,0 +1,262 @@
+#include "FieldStats.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Samples per work item, and per cache resident tile within one item.
+static constexpr size_t STATS_BLOCK_VALUES = 1 << 20;
+static constexpr size_t STATS_TILE_VALUES = 1 << 12;
+
+// A histogram bin holding at most this many samples has them gathered and the
+// percentile selected exactly; a fuller one is split into a finer histogram
+// first, at most STATS_SELECT_LEVELS times.
+static constexpr size_t STATS_SELECT_VALUES = 1 << 16;
+static constexpr int STATS_SELECT_LEVELS = 4;
+
+// Count, mean and sum of squared deviations of a run of samples
+struct Moments {
+    uint64_t n = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+};
+
+// Chan et al.'s pairwise update, exact for merging partial results
+static void merge(Moments& a, const Moments& b)
+{
+    if (b.n == 0) {
+        return;
+    }
+    const double n = double(a.n + b.n);
+    const double delta = b.mean - a.mean;
+    a.mean += delta * double(b.n) / n;
+    a.m2 += b.m2 + delta * delta * double(a.n) * double(b.n) / n;
+    a.n += b.n;
+}
+
+// Two passes over a tile that fits in L1: the sum, then the squared
+// deviations from the tile's mean. Four independent accumulators keep the
+// loops free of a serial dependency, so they pipeline and vectorize.
+template<typename T>
+static Moments tile_moments(const T* p, size_t n)
+{
+    double s[4] = {0.0, 0.0, 0.0, 0.0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s[0] += double(p[i]);
+        s[1] += double(p[i + 1]);
+        s[2] += double(p[i + 2]);
+        s[3] += double(p[i + 3]);
+    }
+    for (; i < n; i++) {
+        s[0] += double(p[i]);
+    }
+    const double mean = (s[0] + s[1] + s[2] + s[3]) / double(n);
+
+    double d[4] = {0.0, 0.0, 0.0, 0.0};
+    i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const double d0 = double(p[i]) - mean;
+        const double d1 = double(p[i + 1]) - mean;
+        const double d2 = double(p[i + 2]) - mean;
+        const double d3 = double(p[i + 3]) - mean;
+        d[0] += d0 * d0;
+        d[1] += d1 * d1;
+        d[2] += d2 * d2;
+        d[3] += d3 * d3;
+    }
+    for (; i < n; i++) {
+        const double d0 = double(p[i]) - mean;
+        d[0] += d0 * d0;
+    }
+
+    Moments m;
+    m.n = n;
+    m.mean = mean;
+    m.m2 = d[0] + d[1] + d[2] + d[3];
+    return m;
+}
+
+double VTKFieldStats::percentile(double fraction) const
+{
+    if (count == 0 || histogram.empty()) {
+        return min;
+    }
+
+    const double target = std::clamp(fraction, 0.0, 1.0) * double(count);
+    const double bin_width = (max - min) / double(histogram.size());
+    double below = 0.0;
+    for (size_t k = 0; k < histogram.size(); k++) {
+        const double in_bin = double(histogram[k]);
+        if (in_bin > 0 && below + in_bin >= target) {
+            double within = (target - below) / in_bin;
+            return std::clamp(min + (double(k) + within) * bin_width, min, max);
+        }
+        below += in_bin;
+    }
+    return max;
+}
+
+// What one pass over the samples finds out about the values in [lo, hi]
+struct RangeCount {
+    uint64_t below = 0;              // Samples below lo, NaNs included
+    uint64_t inside = 0;
+    double low = 0.0;                // Smallest and largest sample inside
+    double high = 0.0;
+    std::vector<uint64_t> histogram; // Equal width bins over [lo, hi], if asked for
+    std::vector<double> values;      // The samples inside, otherwise
+};
+
+template<typename T>
+static RangeCount count_range(const T* samples, size_t count, double lo, double hi, size_t bins)
+{
+    const size_t blocks = (count + STATS_BLOCK_VALUES - 1) / STATS_BLOCK_VALUES;
+    std::vector<RangeCount> parts(blocks);
+    const double scale = hi > lo ? double(bins) / (hi - lo) : 0.0;
+
+    parallel_for(blocks, [&](size_t b) {
+        const size_t begin = b * STATS_BLOCK_VALUES;
+        const size_t end = std::min(count, begin + STATS_BLOCK_VALUES);
+        RangeCount& part = parts[b];
+        part.histogram.assign(bins, 0);
+        part.low = hi;
+        part.high = lo;
+        for (size_t i = begin; i < end; i++) {
+            const double v = double(samples[i]);
+            if (!(v >= lo)) {
+                part.below++;
+            } else if (v <= hi) {
+                part.inside++;
+                part.low = std::min(part.low, v);
+                part.high = std::max(part.high, v);
+                if (bins > 0) {
+                    part.histogram[std::min(size_t((v - lo) * scale), bins - 1)]++;
+                } else {
+                    part.values.push_back(v);
+                }
+            }
+        }
+    });
+
+    RangeCount range;
+    range.histogram.assign(bins, 0);
+    range.low = hi;
+    range.high = lo;
+    for (const RangeCount& part : parts) {
+        range.below += part.below;
+        range.inside += part.inside;
+        range.low = std::min(range.low, part.low);
+        range.high = std::max(range.high, part.high);
+        for (size_t k = 0; k < bins; k++) {
+            range.histogram[k] += part.histogram[k];
+        }
+        range.values.insert(range.values.end(), part.values.begin(), part.values.end());
+    }
+    return range;
+}
+
+// The rank-th smallest sample, counted from 0. `histogram` spans [lo, hi] and
+// `below` samples lie under lo; the bin holding the rank is narrowed down
+// until few enough samples are left in it to select from.
+template<typename T>
+static double select_rank(const T* samples, size_t count, uint64_t rank, double lo, double hi,
+                          std::vector<uint64_t> histogram, uint64_t below)
+{
+    for (int level = 1; ; level++) {
+        const size_t bins = histogram.size();
+        size_t k = 0;
+        for (; k + 1 < bins && below + histogram[k] <= rank; k++) {
+            below += histogram[k];
+        }
+
+        // Widened a little, for a sample the bin index rounded into this bin
+        const double width = (hi - lo) / double(bins);
+        const double slack = width * 1e-6;
+        const double bin_lo = std::max(lo, lo + double(k) * width - slack);
+        const double bin_hi = k + 1 == bins ? hi : std::min(hi, lo + double(k + 1) * width + slack);
+        lo = bin_lo;
+        hi = bin_hi;
+
+        const bool gather = histogram[k] <= STATS_SELECT_VALUES || level == STATS_SELECT_LEVELS;
+        RangeCount range = count_range(samples, count, lo, hi, gather ? 0 : bins);
+        if (rank < range.below || rank >= range.below + range.inside) {
+            // Only NaNs counted into the first bin can get here
+            return lo;
+        }
+        if (range.low == range.high) {
+            return range.low;
+        }
+        if (gather) {
+            auto nth = range.values.begin() + (rank - range.below);
+            std::nth_element(range.values.begin(), nth, range.values.end());
+            return *nth;
+        }
+        histogram = std::move(range.histogram);
+        below = range.below;
+    }
+}
+
+template<typename T>
+VTKFieldStats compute_stats(const T* samples, size_t count, double min, double max, size_t bins)
+{
+    VTKFieldStats stats;
+    stats.min = min;
+    stats.max = max;
+    stats.histogram.assign(bins, 0);
+    stats.count = count;
+    if (count == 0 || bins == 0) {
+        return stats;
+    }
+
+    const size_t blocks = (count + STATS_BLOCK_VALUES - 1) / STATS_BLOCK_VALUES;
+    std::vector<Moments> block_moments(blocks);
+    std::vector<std::vector<uint64_t>> block_histograms(blocks);
+    const double scale = max > min ? double(bins) / (max - min) : 0.0;
+
+    parallel_for(blocks, [&](size_t b) {
+        const size_t begin = b * STATS_BLOCK_VALUES;
+        const size_t end = std::min(count, begin + STATS_BLOCK_VALUES);
+        std::vector<uint64_t>& histogram = block_histograms[b];
+        histogram.assign(bins, 0);
+
+        for (size_t tile = begin; tile < end; tile += STATS_TILE_VALUES) {
+            const size_t n = std::min(STATS_TILE_VALUES, end - tile);
+            merge(block_moments[b], tile_moments(samples + tile, n));
+
+            for (size_t i = tile; i < tile + n; i++) {
+                // NaNs and values below min land in the first bin, max in the last
+                const double t = (double(samples[i]) - min) * scale;
+                histogram[t > 0.0 ? std::min(size_t(t), bins - 1) : 0]++;
+            }
+        }
+    });
+
+    Moments total;
+    for (size_t b = 0; b < blocks; b++) {
+        merge(total, block_moments[b]);
+        for (size_t k = 0; k < bins; k++) {
+            stats.histogram[k] += block_histograms[b][k];
+        }
+    }
+
+    stats.mean = total.mean;
+    stats.variance = total.m2 / double(total.n);
+
+    // Nearest rank percentiles; the histogram alone would put them anywhere
+    // within a bin, and one outlier can make that bin most of the range
+    auto percentile = [&](double fraction) {
+        const uint64_t rank = std::clamp(uint64_t(std::ceil(fraction * double(count))), uint64_t(1), uint64_t(count)) - 1;
+        return select_rank(samples, count, rank, min, max, stats.histogram, 0);
+    };
+    stats.p01 = percentile(0.01);
+    stats.p99 = percentile(0.99);
+    return stats;
+}
+
+#define INSTANTIATE_FIELD_STATS(T) \
+    template VTKFieldStats compute_stats<T>(const T*, size_t, double, double, size_t);
+
+INSTANTIATE_FIELD_STATS(double)
+INSTANTIATE_FIELD_STATS(float)
+INSTANTIATE_FIELD_STATS(short)
+INSTANTIATE_FIELD_STATS(unsigned char)
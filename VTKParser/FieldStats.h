@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Summary of a field's samples, gathered in one parallel sweep.
+struct VTKFieldStats {
+    double min = 0.0;                // Range the histogram spans
+    double max = 0.0;
+    std::vector<uint64_t> histogram; // Equal width bins over [min, max]
+    uint64_t count = 0;
+    double mean = 0.0;
+    double variance = 0.0;
+    double p01 = 0.0;                // 1st percentile, exact nearest rank
+    double p99 = 0.0;                // 99th percentile, exact nearest rank
+
+    // Value below which `fraction` of the samples lie, interpolated within its histogram bin
+    double percentile(double fraction) const;
+};
+
+static constexpr size_t STATS_HISTOGRAM_BINS = 1024;
+
+// `min` and `max` must bound the samples; the parser's min/max do.
+template<typename T>
+VTKFieldStats compute_stats(const T* samples, size_t count, double min, double max, size_t bins = STATS_HISTOGRAM_BINS);
@@ -0,0 +1,58 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const fs::path& filepath, bool copy_on_write)
+{
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file.");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat file.");
+    }
+    m_size = st.st_size;
+
+    if (m_size > 0) {
+        int prot = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* addr = mmap(nullptr, m_size, prot, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to memory map file.");
+        }
+        // The parsers walk the file front to back
+        madvise(addr, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char*>(addr);
+    }
+
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
+
+const char* MappedFile::data() const
+{
+    return m_data;
+}
+
+size_t MappedFile::size() const
+{
+    return m_size;
+}
+
+std::string_view MappedFile::view() const
+{
+    return std::string_view(m_data, m_size);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+// Memory mapping of a whole file. The mapping lives as long as the object.
+// A copy-on-write mapping may be written through data(); the writes stay
+// private to this process and never reach the file.
+class MappedFile {
+public:
+    explicit MappedFile(const fs::path& filepath, bool copy_on_write = false);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const;
+    size_t size() const;
+    std::string_view view() const;
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
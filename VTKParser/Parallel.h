@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline size_t worker_count()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls f(i) for every i in [0, count) on up to worker_count() threads. Work
+// items are handed out one at a time, so uneven items balance themselves.
+// The first exception thrown by any item is rethrown on the calling thread.
+template<typename F>
+void parallel_for(size_t count, F&& f)
+{
+    const size_t threads = std::min(worker_count(), count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Turns the out of order completion of parallel_for items into an in order
+// watermark. complete(i) marks item i done; whenever that extends the run of
+// leading done items, on_advance(run length) is called. Calls never overlap
+// and see increasing run lengths.
+class CompletionFrontier {
+public:
+    CompletionFrontier(size_t count, std::function<void(size_t)> on_advance)
+        : m_done(count, false), m_on_advance(std::move(on_advance)) {}
+
+    void complete(size_t i)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done[i] = true;
+        size_t front = m_front;
+        while (front < m_done.size() && m_done[front]) {
+            front++;
+        }
+        if (front != m_front) {
+            m_front = front;
+            m_on_advance(front);
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<bool> m_done;
+    size_t m_front = 0;
+    std::function<void(size_t)> m_on_advance;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Contiguous samples of a field. The buffer either owns its memory, or views
+// memory kept alive by `owner` (e.g. a memory mapped cache file). Copies of a
+// view share the viewed memory.
+template<typename T>
+class SampleBuffer {
+public:
+    SampleBuffer() = default;
+
+    explicit SampleBuffer(size_t count)
+        : m_storage(count), m_data(m_storage.data()), m_size(count) {}
+
+    SampleBuffer(T* data, size_t count, std::shared_ptr<const void> owner)
+        : m_data(data), m_size(count), m_owner(std::move(owner)) {}
+
+    SampleBuffer(const SampleBuffer& other)
+        : m_storage(other.m_storage), m_size(other.m_size), m_owner(other.m_owner)
+    {
+        m_data = m_owner ? other.m_data : m_storage.data();
+    }
+
+    // Moving a std::vector keeps its heap buffer, so m_data stays valid
+    SampleBuffer(SampleBuffer&& other) noexcept
+        : m_storage(std::move(other.m_storage)), m_data(other.m_data), m_size(other.m_size), m_owner(std::move(other.m_owner))
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    SampleBuffer& operator=(SampleBuffer other) noexcept
+    {
+        std::swap(m_storage, other.m_storage);
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_owner, other.m_owner);
+        return *this;
+    }
+
+    T& operator[](size_t i) { return m_data[i]; }
+    const T& operator[](size_t i) const { return m_data[i]; }
+
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+
+    T* begin() { return m_data; }
+    T* end() { return m_data + m_size; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    bool is_view() const { return m_owner != nullptr; }
+
+private:
+    std::vector<T> m_storage;
+    T* m_data = nullptr;
+    size_t m_size = 0;
+    std::shared_ptr<const void> m_owner;
+};
@@ -0,0 +1,327 @@
+#include "VTIFormat.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+// A start or end tag with its attributes. Entities in values are not expanded.
+struct XmlTag {
+    std::string name;
+    bool closing = false;
+    bool self_closing = false;
+    std::vector<std::pair<std::string, std::string>> attributes;
+    // First byte after the '>'
+    const char* end = nullptr;
+
+    const std::string* attribute(const std::string& key) const
+    {
+        for (const auto& [k, v] : attributes) {
+            if (k == key) {
+                return &v;
+            }
+        }
+        return nullptr;
+    }
+};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static bool starts_with(const char* p, const char* end, const char* prefix)
+{
+    const size_t n = std::strlen(prefix);
+    return size_t(end - p) >= n && std::memcmp(p, prefix, n) == 0;
+}
+
+static void malformed()
+{
+    throw std::runtime_error("Malformed VTK XML file.");
+}
+
+// Reads the next tag at or after p, skipping text, comments, declarations and
+// processing instructions. Returns false at the end of the input.
+static bool next_tag(const char*& p, const char* end, XmlTag& tag)
+{
+    while (true) {
+        p = static_cast<const char*>(std::memchr(p, '<', end - p));
+        if (!p) {
+            p = end;
+            return false;
+        }
+        if (starts_with(p, end, "<!--")) {
+            const char* close = std::search(p + 4, end, "-->", "-->" + 3);
+            if (close == end) {
+                malformed();
+            }
+            p = close + 3;
+        } else if (starts_with(p, end, "<?") || starts_with(p, end, "<!")) {
+            p = static_cast<const char*>(std::memchr(p, '>', end - p));
+            if (!p) {
+                malformed();
+            }
+            p++;
+        } else {
+            break;
+        }
+    }
+
+    tag = XmlTag();
+    p++;
+    if (p < end && *p == '/') {
+        tag.closing = true;
+        p++;
+    }
+    const char* name = p;
+    while (p < end && !is_space(*p) && *p != '>' && *p != '/') {
+        p++;
+    }
+    tag.name.assign(name, p);
+
+    while (true) {
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        if (p >= end) {
+            malformed();
+        }
+        if (*p == '>') {
+            p++;
+            break;
+        }
+        if (*p == '/') {
+            tag.self_closing = true;
+            p++;
+            continue;
+        }
+
+        const char* key = p;
+        while (p < end && *p != '=' && !is_space(*p) && *p != '>') {
+            p++;
+        }
+        std::string key_name(key, p);
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        if (p >= end || *p != '=') {
+            malformed();
+        }
+        p++;
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        if (p >= end || (*p != '"' && *p != '\'')) {
+            malformed();
+        }
+        const char quote = *p++;
+        const char* value = p;
+        p = static_cast<const char*>(std::memchr(p, quote, end - p));
+        if (!p) {
+            malformed();
+        }
+        tag.attributes.emplace_back(std::move(key_name), std::string(value, p));
+        p++;
+    }
+    tag.end = p;
+    return true;
+}
+
+// Reads n whitespace separated numbers of an attribute. Returns false if it is missing.
+template<typename T>
+static bool parse_numbers(const XmlTag& tag, const char* key, T* out, int n)
+{
+    const std::string* value = tag.attribute(key);
+    if (!value) {
+        return false;
+    }
+    std::istringstream iss(*value);
+    for (int i = 0; i < n; i++) {
+        if (!(iss >> out[i])) {
+            throw std::runtime_error(std::string("Failed to parse the ") + key + " of " + tag.name + ".");
+        }
+    }
+    return true;
+}
+
+bool is_xml(const char* begin, const char* end)
+{
+    if (starts_with(begin, end, "\xEF\xBB\xBF")) {
+        begin += 3;
+    }
+    while (begin < end && is_space(*begin)) {
+        begin++;
+    }
+    return begin < end && *begin == '<';
+}
+
+VTIHeader scan_vti(const char* begin, const char* end)
+{
+    VTIHeader header {};
+    header.header_width = 4;
+    header.spacing[0] = header.spacing[1] = header.spacing[2] = 1.0f;
+
+    bool have_file = false;
+    bool have_image = false;
+    bool in_point_data = false;
+    int pieces = 0;
+
+    const char* p = begin;
+    XmlTag tag;
+    while (next_tag(p, end, tag)) {
+        if (tag.closing) {
+            if (tag.name == "PointData") {
+                in_point_data = false;
+            }
+            continue;
+        }
+
+        if (tag.name == "VTKFile") {
+            const std::string* type = tag.attribute("type");
+            if (!type || *type != "ImageData") {
+                throw std::runtime_error("Parser only supports ImageData VTK XML files.");
+            }
+            if (const std::string* compressor = tag.attribute("compressor"); compressor && !compressor->empty()) {
+                throw std::runtime_error("Parser does not support compressed VTK XML files.");
+            }
+            if (const std::string* version = tag.attribute("version")) {
+                header.version = *version;
+            }
+            if (const std::string* byte_order = tag.attribute("byte_order")) {
+                header.big_endian = *byte_order == "BigEndian";
+            }
+            if (const std::string* header_type = tag.attribute("header_type")) {
+                if (*header_type == "UInt64") {
+                    header.header_width = 8;
+                } else if (*header_type != "UInt32") {
+                    throw std::runtime_error("Unsupported VTK XML header type " + *header_type);
+                }
+            }
+            have_file = true;
+        } else if (tag.name == "ImageData") {
+            if (!parse_numbers(tag, "WholeExtent", header.whole_extent, 6)) {
+                throw std::runtime_error("ImageData has no WholeExtent.");
+            }
+            parse_numbers(tag, "Origin", header.origin, 3);
+            parse_numbers(tag, "Spacing", header.spacing, 3);
+            have_image = true;
+        } else if (tag.name == "Piece") {
+            int extent[6];
+            if (++pieces > 1 ||
+                (parse_numbers(tag, "Extent", extent, 6) && !std::equal(extent, extent + 6, header.whole_extent))) {
+                throw std::runtime_error("Parser only supports ImageData files with a single piece.");
+            }
+        } else if (tag.name == "PointData") {
+            in_point_data = !tag.self_closing;
+        } else if (tag.name == "DataArray" && in_point_data) {
+            VTIArray array {};
+            const std::string* name = tag.attribute("Name");
+            const std::string* type = tag.attribute("type");
+            const std::string* format = tag.attribute("format");
+            if (!name || !type || !format) {
+                throw std::runtime_error("DataArray needs a Name, type and format.");
+            }
+            array.name = *name;
+            array.type = *type;
+            array.components = 1;
+            parse_numbers(tag, "NumberOfComponents", &array.components, 1);
+
+            if (*format == "appended") {
+                array.format = VTIFormat::Appended;
+                if (!parse_numbers(tag, "offset", &array.offset, 1)) {
+                    throw std::runtime_error("Appended DataArray " + array.name + " has no offset.");
+                }
+            } else if (*format == "ascii" || *format == "binary") {
+                array.format = *format == "ascii" ? VTIFormat::Ascii : VTIFormat::Binary;
+                array.text_begin = tag.end;
+                array.text_end = tag.end;
+                if (!tag.self_closing) {
+                    // Neither text nor base64 holds a '<', so the text ends at the next tag
+                    p = static_cast<const char*>(std::memchr(tag.end, '<', end - tag.end));
+                    if (!p) {
+                        malformed();
+                    }
+                    array.text_end = p;
+                }
+            } else {
+                throw std::runtime_error("Unknown DataArray format " + *format);
+            }
+            header.arrays.push_back(std::move(array));
+        } else if (tag.name == "AppendedData") {
+            const std::string* encoding = tag.attribute("encoding");
+            if (!encoding || (*encoding != "raw" && *encoding != "base64")) {
+                throw std::runtime_error("Unknown AppendedData encoding.");
+            }
+            header.appended_base64 = *encoding == "base64";
+            // Raw appended bytes may look like markup, so scanning stops here
+            const char* marker = static_cast<const char*>(std::memchr(tag.end, '_', end - tag.end));
+            if (!marker) {
+                malformed();
+            }
+            header.appended = marker + 1;
+            break;
+        }
+    }
+
+    if (!have_file || !have_image) {
+        throw std::runtime_error("Not a VTK XML ImageData file.");
+    }
+    return header;
+}
+
+const char* decode_base64(const char* in, const char* end, char* out, size_t n)
+{
+    static const std::array<int8_t, 256> values = [] {
+        std::array<int8_t, 256> table;
+        table.fill(-1);
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; i++) {
+            table[uint8_t(alphabet[i])] = int8_t(i);
+        }
+        return table;
+    }();
+
+    size_t written = 0;
+    while (written < n) {
+        char quad[4];
+        for (int got = 0; got < 4;) {
+            if (in >= end) {
+                throw std::runtime_error("Base64 data ended too soon.");
+            }
+            const char c = *in++;
+            if (!is_space(c)) {
+                quad[got++] = c;
+            }
+        }
+
+        // "xx==" and "xxx=" end a stream early, with one or two bytes
+        const int bytes = quad[2] == '=' ? 1 : quad[3] == '=' ? 2 : 3;
+        uint32_t bits = 0;
+        for (int i = 0; i < 4; i++) {
+            const int8_t v = i <= bytes ? values[uint8_t(quad[i])] : 0;
+            if (v < 0 || (i > bytes && quad[i] != '=')) {
+                throw std::runtime_error("Malformed base64 data.");
+            }
+            bits = bits << 6 | uint32_t(v);
+        }
+
+        const char decoded[3] = { char(bits >> 16), char(bits >> 8), char(bits) };
+        const size_t take = std::min(size_t(bytes), n - written);
+        std::memcpy(out + written, decoded, take);
+        written += take;
+    }
+    return in;
+}
+
+std::string legacy_type(const std::string& vti_type)
+{
+    if (vti_type == "Float64") return "double";
+    if (vti_type == "Float32") return "float";
+    if (vti_type == "Int16") return "short";
+    if (vti_type == "UInt8") return "unsigned_char";
+    return "";
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The parts of a VTK XML ImageData (.vti) file the parser needs, read from its
+// XML markup. Sample data is only located here, never decoded.
+
+enum class VTIFormat {
+    Ascii,    // Whitespace separated text inside the DataArray element
+    Binary,   // Base64 text inside the DataArray element
+    Appended  // In the AppendedData section, at `offset` past its '_' marker
+};
+
+struct VTIArray {
+    std::string name;
+    std::string type;  // VTK XML type name, e.g. Float32
+    int components;
+    VTIFormat format;
+    size_t offset;
+    // Text of an Ascii or Binary array
+    const char* text_begin;
+    const char* text_end;
+};
+
+struct VTIHeader {
+    std::string version;
+    bool big_endian;
+    // Size of the block size header before each binary array, 4 or 8 bytes
+    size_t header_width;
+    int whole_extent[6];
+    float origin[3];
+    float spacing[3];
+    // Arrays of the PointData element, in file order
+    std::vector<VTIArray> arrays;
+    // First byte after the AppendedData '_' marker, or nullptr if there is none
+    const char* appended;
+    bool appended_base64;
+};
+
+// True if the file looks like XML rather than a legacy VTK file
+bool is_xml(const char* begin, const char* end);
+
+// Reads the markup up to the appended data. Throws if the file is not a single
+// piece, uncompressed ImageData file.
+VTIHeader scan_vti(const char* begin, const char* end);
+
+// Decodes base64 text until n bytes are written to out, skipping whitespace.
+// Padding may end one encoded block and another may follow, since VTK encodes
+// a block size header and its data either as one or as two base64 streams.
+// Returns the position after the text consumed; throws on malformed text.
+const char* decode_base64(const char* in, const char* end, char* out, size_t n);
+
+// Legacy type name (see VTKFieldInfo::type) of a VTK XML type the parser can
+// load, or an empty string
+std::string legacy_type(const std::string& vti_type);
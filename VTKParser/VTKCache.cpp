@@ -0,0 +1,348 @@
+#include "VTKCache.h"
+#include "BlockCodec.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+static constexpr char CACHE_MAGIC[8] = {'S', 'F', 'V', 'C', 'A', 'C', 'H', 'E'};
+static constexpr uint32_t CACHE_VERSION = 2;
+// Written in host byte order; a cache from a host of the other endianness reads back swapped
+static constexpr uint32_t CACHE_BYTE_ORDER = 0x01020304;
+static constexpr size_t CACHE_ALIGNMENT = 64;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t source_size;
+    int64_t source_mtime;
+    int32_t dimension[3];
+    float origin[3];
+    float spacing[3];
+    uint32_t field_count;
+    char vtk_version[16];
+    char title[256];
+};
+
+struct CacheFieldEntry {
+    char name[64];
+    char type[32];     // Sample type declared by the source file
+    uint32_t storage;  // VTKFieldVariant index of the cached samples
+    uint32_t codec;    // VTKCacheCodec the samples were written with
+    uint64_t count;
+    double min;
+    double max;
+    double error_bound;
+    uint64_t offset;   // Byte offset of the samples, a multiple of CACHE_ALIGNMENT
+    uint64_t bytes;    // Stored size of the samples
+};
+
+static size_t align_up(size_t offset)
+{
+    return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+static std::string fixed_string(const char* s, size_t capacity)
+{
+    return std::string(s, strnlen(s, capacity));
+}
+
+bool VTKCache::source_stamp(const fs::path& source, uint64_t& size, int64_t& mtime)
+{
+    std::error_code ec;
+    size = fs::file_size(source, ec);
+    if (ec) {
+        return false;
+    }
+    auto time = fs::last_write_time(source, ec);
+    if (ec) {
+        return false;
+    }
+    mtime = time.time_since_epoch().count();
+    return true;
+}
+
+// Copies every stride-th sample of `region` out of a cached field of a
+// `source` grid. Only the rows holding kept samples are touched: raw arrays are
+// read in place, and of compressed ones only the blocks under those rows are
+// decoded.
+template<typename T>
+static void read_subgrid(const CacheFieldEntry& entry, const MappedFile& file, Dimension source,
+        const VTKRegion& region, int stride, VTKField<T>& field)
+{
+    const Dimension& dim = field.dimension;
+    const Dimension b = region.begin;
+    const char* stored = file.data() + entry.offset;
+    const bool raw = VTKCacheCodec(entry.codec) == VTKCacheCodec::Raw;
+
+    field.data = SampleBuffer<T>(size_t(dim.x) * dim.y * dim.z);
+    std::vector<T> slice_min(dim.z);
+    std::vector<T> slice_max(dim.z);
+    parallel_for(dim.z, [&](size_t k) {
+        // First and one past the last sample of the slice's kept rows
+        const size_t z = b.z + k * stride;
+        const size_t first = (z * source.y + b.y) * source.x + b.x;
+        const size_t last = first + size_t(dim.y - 1) * stride * source.x + size_t(dim.x - 1) * stride + 1;
+
+        std::vector<T> decoded;
+        const T* samples = reinterpret_cast<const T*>(stored) + first;
+        if (!raw) {
+            decoded.resize(last - first);
+            decode_sample_range(stored, entry.bytes, entry.count, first, last - first, decoded.data());
+            samples = decoded.data();
+        }
+
+        T vmin = std::numeric_limits<T>::max();
+        T vmax = std::numeric_limits<T>::lowest();
+        for (int j = 0; j < dim.y; j++) {
+            const T* row = samples + size_t(j) * stride * source.x;
+            for (int i = 0; i < dim.x; i++) {
+                const T value = row[size_t(i) * stride];
+                field(i, j, k) = value;
+                vmin = std::min(vmin, value);
+                vmax = std::max(vmax, value);
+            }
+        }
+        slice_min[k] = vmin;
+        slice_max[k] = vmax;
+    });
+
+    field.min = *std::min_element(slice_min.begin(), slice_min.end());
+    field.max = *std::max_element(slice_max.begin(), slice_max.end());
+}
+
+template<typename T>
+static VTKField<T> make_field(const CacheFieldEntry& entry, const VTKData& data, const std::shared_ptr<MappedFile>& file,
+        Dimension source, const VTKRegion& region, const VTKParseOptions& options)
+{
+    VTKField<T> field;
+    field.name = fixed_string(entry.name, sizeof(entry.name));
+    field.dimension = data.dimension;
+    field.spacing = data.spacing;
+    if (!options.full_grid()) {
+        read_subgrid(entry, *file, source, region, options.stride, field);
+        return field;
+    }
+    if (VTKCacheCodec(entry.codec) == VTKCacheCodec::Raw) {
+        // The mapping is copy-on-write, so the field may be modified like a parsed one
+        T* samples = reinterpret_cast<T*>(const_cast<char*>(file->data()) + entry.offset);
+        field.data = SampleBuffer<T>(samples, entry.count, file);
+    } else {
+        field.data = SampleBuffer<T>(entry.count);
+        decode_samples(file->data() + entry.offset, entry.bytes, field.data.data(), entry.count);
+    }
+    field.min = T(entry.min);
+    field.max = T(entry.max);
+    return field;
+}
+
+fs::path VTKCache::path_for(const fs::path& source)
+{
+    fs::path path = source;
+    path += ".cache";
+    return path;
+}
+
+std::optional<VTKData> VTKCache::load(const fs::path& source, const VTKParseOptions& options)
+{
+    fs::path path = path_for(source);
+    std::error_code ec;
+    if (!fs::is_regular_file(path, ec)) {
+        return std::nullopt;
+    }
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!source_stamp(source, source_size, source_mtime)) {
+        return std::nullopt;
+    }
+
+    std::shared_ptr<MappedFile> file;
+    try {
+        file = std::make_shared<MappedFile>(path, true);
+    } catch (const std::runtime_error&) {
+        return std::nullopt;
+    }
+
+    CacheHeader header;
+    if (file->size() < sizeof(header)) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.byte_order != CACHE_BYTE_ORDER ||
+        header.source_size != source_size ||
+        header.source_mtime != source_mtime) {
+        return std::nullopt;
+    }
+
+    size_t entries_end = sizeof(header) + size_t(header.field_count) * sizeof(CacheFieldEntry);
+    if (entries_end > file->size()) {
+        return std::nullopt;
+    }
+
+    VTKData data;
+    data.version = fixed_string(header.vtk_version, sizeof(header.vtk_version));
+    data.title = fixed_string(header.title, sizeof(header.title));
+    data.dimension = {header.dimension[0], header.dimension[1], header.dimension[2]};
+    data.origin = {header.origin[0], header.origin[1], header.origin[2]};
+    data.spacing = {header.spacing[0], header.spacing[1], header.spacing[2]};
+
+    const Dimension source_dimension = data.dimension;
+    if (source_dimension.x < 1 || source_dimension.y < 1 || source_dimension.z < 1) {
+        return std::nullopt;
+    }
+    const size_t source_count = size_t(source_dimension.x) * source_dimension.y * source_dimension.z;
+    const VTKRegion region = VTKParser::select_subgrid(data, options);
+
+    static constexpr size_t sample_size[] = {sizeof(double), sizeof(float), sizeof(short), sizeof(unsigned char)};
+    for (uint32_t i = 0; i < header.field_count; i++) {
+        CacheFieldEntry entry;
+        std::memcpy(&entry, file->data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+
+        VTKFieldInfo info;
+        info.name = fixed_string(entry.name, sizeof(entry.name));
+        info.count = long(entry.count);
+        info.type = fixed_string(entry.type, sizeof(entry.type));
+        info.offset = 0;
+        info.first_token = 0;
+
+        // A cache written with other options holds the wrong sample type or precision
+        if (entry.storage != VTKParser::storage_index(info.type, options.storage) ||
+            VTKCacheCodec(entry.codec) != options.cache_codec ||
+            (options.cache_codec == VTKCacheCodec::Lossy && entry.error_bound != options.cache_error_bound)) {
+            return std::nullopt;
+        }
+        if (entry.count != source_count ||
+            entry.offset % CACHE_ALIGNMENT != 0 ||
+            entry.offset > file->size() ||
+            entry.bytes > file->size() - entry.offset ||
+            (options.cache_codec == VTKCacheCodec::Raw && entry.bytes != entry.count * sample_size[entry.storage])) {
+            return std::nullopt;
+        }
+
+        try {
+            switch (entry.storage) {
+                case 0:
+                    data.fields.emplace_back(make_field<double>(entry, data, file, source_dimension, region, options));
+                    break;
+                case 1:
+                    data.fields.emplace_back(make_field<float>(entry, data, file, source_dimension, region, options));
+                    break;
+                case 2:
+                    data.fields.emplace_back(make_field<short>(entry, data, file, source_dimension, region, options));
+                    break;
+                case 3:
+                    data.fields.emplace_back(make_field<unsigned char>(entry, data, file, source_dimension, region, options));
+                    break;
+            }
+        } catch (const std::runtime_error&) {
+            return std::nullopt;
+        }
+        data.field_index.push_back(std::move(info));
+    }
+
+    return data;
+}
+
+bool VTKCache::store(const fs::path& source, const VTKData& data, const VTKParseOptions& options)
+{
+    CacheHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byte_order = CACHE_BYTE_ORDER;
+    if (!source_stamp(source, header.source_size, header.source_mtime)) {
+        return false;
+    }
+    header.dimension[0] = data.dimension.x;
+    header.dimension[1] = data.dimension.y;
+    header.dimension[2] = data.dimension.z;
+    header.origin[0] = data.origin.x;
+    header.origin[1] = data.origin.y;
+    header.origin[2] = data.origin.z;
+    header.spacing[0] = data.spacing.x;
+    header.spacing[1] = data.spacing.y;
+    header.spacing[2] = data.spacing.z;
+    header.field_count = uint32_t(data.fields.size());
+    std::strncpy(header.vtk_version, data.version.c_str(), sizeof(header.vtk_version) - 1);
+    std::strncpy(header.title, data.title.c_str(), sizeof(header.title) - 1);
+
+    const double error_bound = options.cache_codec == VTKCacheCodec::Lossy ? options.cache_error_bound : 0.0;
+    std::vector<CacheFieldEntry> entries(data.fields.size());
+    std::vector<std::vector<char>> encoded(data.fields.size());
+    size_t offset = align_up(sizeof(header) + entries.size() * sizeof(CacheFieldEntry));
+    for (size_t i = 0; i < entries.size(); i++) {
+        const VTKFieldInfo& info = data.field_index[i];
+        CacheFieldEntry& entry = entries[i];
+        std::memset(&entry, 0, sizeof(entry));
+        if (info.name.size() >= sizeof(entry.name) || info.type.size() >= sizeof(entry.type)) {
+            return false;
+        }
+        std::memcpy(entry.name, info.name.data(), info.name.size());
+        std::memcpy(entry.type, info.type.data(), info.type.size());
+        entry.storage = uint32_t(data.fields[i].index());
+        entry.codec = uint32_t(options.cache_codec);
+        entry.error_bound = error_bound;
+        std::visit([&](const auto& f) {
+            entry.count = f.data.size();
+            entry.min = double(f.min);
+            entry.max = double(f.max);
+            if (options.cache_codec == VTKCacheCodec::Raw) {
+                entry.bytes = f.data.size() * sizeof(f.data[0]);
+            } else {
+                encoded[i] = encode_samples(f.data.data(), f.data.size(), error_bound);
+                entry.bytes = encoded[i].size();
+            }
+            entry.offset = offset;
+            offset = align_up(offset + entry.bytes);
+        }, data.fields[i]);
+    }
+
+    // Write next to the cache and rename, so a reader never sees a partial file
+    fs::path path = path_for(source);
+    fs::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(CacheFieldEntry));
+
+        static const char padding[CACHE_ALIGNMENT] = {};
+        size_t written = sizeof(header) + entries.size() * sizeof(CacheFieldEntry);
+        for (size_t i = 0; i < entries.size(); i++) {
+            out.write(padding, entries[i].offset - written);
+            if (options.cache_codec == VTKCacheCodec::Raw) {
+                std::visit([&](const auto& f) {
+                    out.write(reinterpret_cast<const char*>(f.data.data()), entries[i].bytes);
+                }, data.fields[i]);
+            } else {
+                out.write(encoded[i].data(), entries[i].bytes);
+            }
+            written = entries[i].offset + entries[i].bytes;
+        }
+
+        if (!out) {
+            out.close();
+            std::error_code ec;
+            fs::remove(tmp_path, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
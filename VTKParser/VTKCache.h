@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "VTKParser.h"
+
+// Binary sidecar file written next to a .vtk file once all of its fields have
+// been parsed. It holds the geometry, the per-field min/max and the samples as
+// 64 byte aligned arrays, so later opens read it instead of parsing the source
+// again. Raw arrays are mapped and viewed in place; arrays written with a
+// compressing VTKCacheCodec are decoded in parallel into the fields. A cache is
+// only used while the source file keeps the size and modification time it was
+// written for, and only with the codec it was written with.
+class VTKCache {
+public:
+    static fs::path path_for(const fs::path& source);
+
+    // Returns std::nullopt if there is no usable cache for `source`
+    static std::optional<VTKData> load(const fs::path& source, const VTKParseOptions& options);
+
+    // Returns false if the cache could not be written (e.g. read-only directory)
+    static bool store(const fs::path& source, const VTKData& data, const VTKParseOptions& options);
+
+    // Size and modification time a derived file records to tell if `source` changed since
+    static bool source_stamp(const fs::path& source, uint64_t& size, int64_t& mtime);
+};
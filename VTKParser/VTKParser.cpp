@@ -1,7 +1,13 @@
 #include "VTKParser.h"
+#include "ByteSwap.h"
+#include "Parallel.h"
+#include "VTIFormat.h"
+#include "VTKCache.h"
 
 #include <algorithm>
-#include <fstream>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -18,28 +24,370 @@
 #define RUNTIME_VERIFY(cond) \
     { if (!(cond)) { throw std::runtime_error("VERIFY FAILED " #cond " [" __FILE__ ":" TOSTRING(__LINE__) "]"); } }
 
-VTKParser::VTKParser(std::unique_ptr<std::istream> is)
-    : m_is(std::move(is)) {}
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
 
-VTKData VTKParser::from_file(const fs::path& filepath)
+// Target size of the slices an ASCII FIELD block is split into for parallel parsing.
+static constexpr size_t ASCII_CHUNK_BYTES = 1 << 20;
+// Number of values byte-swapped per work item for binary fields.
+static constexpr size_t BINARY_CHUNK_VALUES = 1 << 18;
+
+static size_t count_tokens(const char* p, const char* end)
 {
-    auto file = std::make_unique<std::ifstream>(filepath);
-    if (!file->is_open()) {
-        throw std::runtime_error("Failed to open file.");
+    size_t tokens = 0;
+    bool in_token = false;
+    for (; p < end; p++) {
+        bool space = is_space(*p);
+        tokens += !space && !in_token;
+        in_token = !space;
     }
+    return tokens;
+}
 
-    VTKParser parser = VTKParser(std::move(file));
-    return parser.parse();
+static const char* skip_tokens(const char* p, const char* end, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        while (p < end && !is_space(*p)) {
+            p++;
+        }
+    }
+    return p;
+}
+
+// Parses `count` whitespace separated values into `out` and reduces their min/max.
+// Returns the position after the last value, or nullptr if a value is malformed.
+template<typename T>
+static const char* parse_values(const char* p, const char* end, size_t count, T* out, T& out_min, T& out_max)
+{
+    T vmin = std::numeric_limits<T>::max();
+    T vmax = std::numeric_limits<T>::lowest();
+
+    for (size_t j = 0; j < count; j++) {
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        if (p < end && *p == '+') {
+            p++;
+        }
+
+        T val;
+        auto [next, ec] = std::from_chars(p, end, val);
+        if (ec != std::errc()) {
+            return nullptr;
+        }
+        p = next;
+
+        vmax = std::max(vmax, val);
+        vmin = std::min(vmin, val);
+        out[j] = val;
+    }
+
+    out_min = vmin;
+    out_max = vmax;
+    return p;
+}
+
+// Size in bytes of a legacy VTK data type, or 0 if the parser does not support it.
+static size_t type_width(const std::string& type)
+{
+    if (type == "double") return sizeof(double);
+    if (type == "float") return sizeof(float);
+    if (type == "short") return sizeof(short);
+    if (type == "unsigned_char") return sizeof(unsigned char);
+    return 0;
+}
+
+VTKParser::VTKParser(const fs::path& filepath, const VTKParseOptions& options)
+    // Copy-on-write, so fields that view the mapping may be modified like parsed ones
+    : m_path(filepath), m_file(std::make_shared<MappedFile>(filepath, true)), m_options(options)
+{
+    m_cur = m_file->data();
+    m_end = m_file->data() + m_file->size();
+}
+
+VTKData VTKParser::from_file(const fs::path& filepath, const VTKParseOptions& options)
+{
+    if (options.stride < 1) {
+        throw std::runtime_error("The stride must be at least 1.");
+    }
+
+    // The cache holds the whole grid; decimated and cropped loads pick their samples out of it
+    if (options.cache) {
+        if (auto cached = VTKCache::load(filepath, options)) {
+            dbg("Loaded " << filepath << " from " << VTKCache::path_for(filepath));
+            for (size_t i = 0; i < cached->fields.size(); i++) {
+                if (options.stats) {
+                    field_stats(cached->fields[i]);
+                }
+                if (options.progress) {
+                    size_t bytes = std::visit([](const auto& f) { return f.data.size() * sizeof(f.data[0]); }, cached->fields[i]);
+                    options.progress(VTKLoadProgress { i, bytes, bytes, cached->dimension, cached->spacing });
+                }
+            }
+            return std::move(*cached);
+        }
+    }
+
+    std::shared_ptr<VTKParser> parser(new VTKParser(filepath, options));
+    VTKData data = parser->parse();
+
+    if (options.lazy) {
+        data.loader = parser;
+    } else {
+        for (size_t i = 0; i < data.fields.size(); i++) {
+            parser->load_field(data, i);
+        }
+    }
+    return data;
 }
 
 VTKData VTKParser::parse()
 {
-    parse_header();
-    parse_title();
-    parse_datatype();
-    parse_geomtype();
-    parse_data();
-    return m_data;
+    if (is_xml(m_cur, m_end)) {
+        parse_vti();
+    } else {
+        parse_header();
+        parse_title();
+        parse_datatype();
+        parse_geomtype();
+        parse_data();
+    }
+
+    m_source_dimension = m_data.dimension;
+    m_region = select_subgrid(m_data, m_options);
+    return std::move(m_data);
+}
+
+VTKRegion VTKParser::select_subgrid(VTKData& data, const VTKParseOptions& options)
+{
+    const Dimension dim = data.dimension;
+    const VTKRegion region = options.region.value_or(VTKRegion { {0, 0, 0}, dim });
+
+    auto inside = [](int begin, int size, int extent) {
+        return begin >= 0 && size >= 1 && long(begin) + size <= extent;
+    };
+    if (!inside(region.begin.x, region.size.x, dim.x) ||
+        !inside(region.begin.y, region.size.y, dim.y) ||
+        !inside(region.begin.z, region.size.z, dim.z)) {
+        throw std::runtime_error("The region to load is not inside the grid.");
+    }
+
+    const int stride = options.stride;
+    data.origin = {
+        data.origin.x + region.begin.x * data.spacing.x,
+        data.origin.y + region.begin.y * data.spacing.y,
+        data.origin.z + region.begin.z * data.spacing.z
+    };
+    data.dimension = {
+        (region.size.x - 1) / stride + 1,
+        (region.size.y - 1) / stride + 1,
+        (region.size.z - 1) / stride + 1
+    };
+    data.spacing = { data.spacing.x * stride, data.spacing.y * stride, data.spacing.z * stride };
+    return region;
+}
+
+size_t VTKParser::storage_index(const std::string& type, VTKStorage storage)
+{
+    switch (storage) {
+        case VTKStorage::Double:
+            return 0;
+        case VTKStorage::Float:
+            return 1;
+        case VTKStorage::Native:
+            break;
+    }
+
+    if (type == "float") return 1;
+    if (type == "short") return 2;
+    if (type == "unsigned_char") return 3;
+    return 0;
+}
+
+void VTKParser::load_field(VTKData& data, size_t i, const VTKSliceCallback& on_slices)
+{
+    switch (storage_index(data.field_index[i].type, m_options.storage)) {
+        case 0:
+            load_field_as<double>(data, i, on_slices);
+            break;
+        case 1:
+            load_field_as<float>(data, i, on_slices);
+            break;
+        case 2:
+            load_field_as<short>(data, i, on_slices);
+            break;
+        case 3:
+            load_field_as<unsigned char>(data, i, on_slices);
+            break;
+    }
+
+    // Once every field has been parsed, keep them for the next time this file is opened
+    if (m_options.cache && m_options.full_grid()) {
+        for (size_t j = 0; j < data.fields.size(); j++) {
+            if (!data.is_loaded(j)) {
+                return;
+            }
+        }
+        if (!VTKCache::store(m_path, data, m_options)) {
+            dbg("Could not write " << VTKCache::path_for(m_path));
+        }
+    }
+}
+
+template<typename T>
+void VTKParser::load_field_as(VTKData& data, size_t i, const VTKSliceCallback& on_slices)
+{
+    const VTKFieldInfo& info = data.field_index[i];
+
+    VTKField<T> view;
+    if (view_field(view, info)) {
+        view.name = info.name;
+        view.dimension = data.dimension;
+        view.spacing = data.spacing;
+        data.fields[i] = std::move(view);
+        if (on_slices) {
+            on_slices(data.dimension.z);
+        }
+        const size_t bytes = info.count * sizeof(T);
+        report_progress(data, i, bytes, bytes);
+    } else {
+        // Parsed in place, so a streaming reader can look at the slices that are done
+        data.fields[i] = VTKField<T>(info.name, data.dimension, data.spacing);
+        VTKField<T>& field = std::get<VTKField<T>>(data.fields[i]);
+
+        AdvanceCallback on_advance;
+        if (on_slices || m_options.progress) {
+            const size_t slice_values = size_t(data.dimension.x) * data.dimension.y;
+            on_advance = [&, slice_values](size_t values, size_t bytes_done, size_t bytes_total) {
+                if (on_slices) {
+                    on_slices(int(values / slice_values));
+                }
+                report_progress(data, i, bytes_done, bytes_total);
+            };
+        }
+
+        const bool binary = info.encoding != VTKEncoding::Ascii;
+        if (!m_options.full_grid()) {
+            if (binary) {
+                read_subgrid_binary(field, info, on_advance);
+            } else {
+                read_subgrid_ascii(field, info, on_advance);
+            }
+        } else if (binary) {
+            read_binary_values(info, 0, field.data.size(), field.data.data(), field.min, field.max, on_advance);
+        } else {
+            read_ascii_values(info, 0, field.data.size(), field.data.data(), field.min, field.max, on_advance);
+        }
+    }
+
+    if (m_options.stats) {
+        field_stats(std::get<VTKField<T>>(data.fields[i]));
+    }
+}
+
+template<typename T>
+bool VTKParser::view_field(VTKField<T>& field, const VTKFieldInfo& info)
+{
+    // Only a whole field of raw samples that are stored as they are in the
+    // file, in host byte order and aligned for T, can be used in place
+    const char* values = m_file->data() + info.offset;
+    if (info.encoding != VTKEncoding::Raw || !m_options.full_grid() ||
+        storage_index(info.type, VTKStorage::Native) != storage_index(info.type, m_options.storage) ||
+        info.big_endian == host_is_little_endian() ||
+        reinterpret_cast<uintptr_t>(values) % alignof(T) != 0 ||
+        size_t(m_end - values) < info.count * sizeof(T)) {
+        return false;
+    }
+
+    const size_t count = info.count;
+    T* samples = reinterpret_cast<T*>(const_cast<char*>(values));
+    field.data = SampleBuffer<T>(samples, count, m_file);
+
+    // Only read, so no page of the mapping is copied
+    const size_t blocks = (count + BINARY_CHUNK_VALUES - 1) / BINARY_CHUNK_VALUES;
+    std::vector<T> block_min(blocks);
+    std::vector<T> block_max(blocks);
+    parallel_for(blocks, [&](size_t b) {
+        const T* begin = samples + b * BINARY_CHUNK_VALUES;
+        const T* end = samples + std::min(count, (b + 1) * BINARY_CHUNK_VALUES);
+        auto [vmin, vmax] = std::minmax_element(begin, end);
+        block_min[b] = *vmin;
+        block_max[b] = *vmax;
+    });
+    field.min = *std::min_element(block_min.begin(), block_min.end());
+    field.max = *std::max_element(block_max.begin(), block_max.end());
+    return true;
+}
+
+template<typename T>
+void VTKParser::read_slab(const VTKData& data, size_t i, int z, int slices, T* out, T& out_min, T& out_max)
+{
+    if (!m_options.full_grid()) {
+        throw std::runtime_error("Slabs can only be read from a whole, full resolution grid.");
+    }
+
+    const VTKFieldInfo& info = data.field_index[i];
+    const size_t slice_values = size_t(data.dimension.x) * data.dimension.y;
+    if (info.encoding != VTKEncoding::Ascii) {
+        read_binary_values(info, z * slice_values, slices * slice_values, out, out_min, out_max, {});
+    } else {
+        read_ascii_values(info, z * slice_values, slices * slice_values, out, out_min, out_max, {});
+    }
+}
+
+const fs::path& VTKParser::path() const
+{
+    return m_path;
+}
+
+const VTKParseOptions& VTKParser::options() const
+{
+    return m_options;
+}
+
+void VTKData::stream_field(size_t i, const VTKSliceCallback& on_slices)
+{
+    if (is_loaded(i)) {
+        on_slices(dimension.z);
+        return;
+    }
+    if (!loader) {
+        throw std::runtime_error("Field " + field_index[i].name + " is not loaded.");
+    }
+    loader->load_field(*this, i, on_slices);
+}
+
+void VTKParser::report_progress(const VTKData& data, size_t field, size_t bytes_done, size_t bytes_total) const
+{
+    if (m_options.progress) {
+        m_options.progress(VTKLoadProgress { field, bytes_done, bytes_total, data.dimension, data.spacing });
+    }
+}
+
+VTKFieldVariant& VTKData::field(size_t i)
+{
+    if (!is_loaded(i)) {
+        if (!loader) {
+            throw std::runtime_error("Field " + field_index[i].name + " is not loaded.");
+        }
+        try {
+            loader->load_field(*this, i);
+        } catch (...) {
+            fields[i] = VTKFieldVariant();
+            throw;
+        }
+    }
+    return fields[i];
+}
+
+bool VTKData::is_loaded(size_t i) const
+{
+    return std::visit([](const auto& field) { return !field.data.empty(); }, fields[i]);
 }
 
 void VTKParser::parse_header()
@@ -75,9 +423,10 @@ void VTKParser::parse_datatype()
     std::string data_type;
     if (get_line(data_type)) {
         dbg("DATA TYPE: " << data_type);
-        if (data_type != "ASCII") {
-            // TODO: Add support for other legacy VTK file data types
-            throw std::runtime_error("Parser only supports ASCII VTK files.");
+        if (data_type == "BINARY") {
+            m_binary = true;
+        } else if (data_type != "ASCII") {
+            throw std::runtime_error("Parser only supports ASCII and BINARY VTK files.");
         }
     } else {
         throw std::runtime_error("VTK file ended too soon. Could not find data type line.");
@@ -160,10 +509,11 @@ void VTKParser::parse_field()
         iss >> field >> field_name >> field_count;
 
         if (field == "FIELD") {
-            for (int i = 0; i < field_count; i++) {
-                double field_min = std::numeric_limits<double>::max();
-                double field_max = std::numeric_limits<double>::min();
+            if (!m_binary) {
+                m_token = index_tokens(m_cur, m_end);
+            }
 
+            for (int i = 0; i < field_count; i++) {
                 std::string line;
                 if (get_line(line)) {
                     std::istringstream iss(line);
@@ -175,33 +525,21 @@ void VTKParser::parse_field()
 
                     RUNTIME_VERIFY(sf_components == 1);
                     RUNTIME_VERIFY(m_data.dimension.x * m_data.dimension.y * m_data.dimension.z == sf_count);
-                    RUNTIME_VERIFY(sf_type == "double");
-
-                    VTKField<double> new_field(sf_name, m_data.dimension, m_data.spacing);
-                    for (int j = 0; j < sf_count; j++) {
-                        std::string data_line;
-                        if (!get_line(data_line)) {
-                            throw std::runtime_error("Failed to parse the scalar field " + sf_name);
-                        }
-                        std::istringstream diss(data_line);
-
-                        // TODO: Make this agnostic to the number of values per line
-                        for (int p = 0; p < 9; p++) {
-                            double val;
-                            diss >> val;
-
-                            field_max = std::max(field_max, val);
-                            field_min = std::min(field_min, val);
-
-                            new_field.data[j++] = val;
-                        }
-                        j--;
-                    }
+                    RUNTIME_VERIFY(type_width(sf_type) != 0);
 
-                    new_field.min = field_min;
-                    new_field.max = field_max;
+                    // Only record where the samples are, they are parsed by load_field()
+                    VTKFieldInfo info {
+                        sf_name,
+                        sf_count,
+                        sf_type,
+                        size_t(m_cur - m_file->data()),
+                        m_token + count_tokens(line.data(), line.data() + line.size())
+                    };
+                    info.encoding = m_binary ? VTKEncoding::Raw : VTKEncoding::Ascii;
+                    skip_values(info);
 
-                    m_data.fields.push_back(new_field);
+                    m_data.field_index.push_back(info);
+                    m_data.fields.emplace_back();
                 } else {
                     throw std::runtime_error("Failed to parse the field " + field_name);
                 }
@@ -215,11 +553,477 @@ void VTKParser::parse_field()
     }
 }
 
+size_t VTKParser::index_tokens(const char* text_begin, const char* text_end)
+{
+    // Split the text into newline aligned chunks
+    const size_t first_chunk = m_chunks.size();
+    const char* begin = text_begin;
+    while (begin < text_end) {
+        const char* end = begin + std::min<size_t>(ASCII_CHUNK_BYTES, text_end - begin);
+        if (end < text_end) {
+            const char* eol = static_cast<const char*>(std::memchr(end, '\n', text_end - end));
+            end = eol ? eol + 1 : text_end;
+        }
+        m_chunks.push_back(TokenChunk { begin, end, 0, 0 });
+        begin = end;
+    }
+    const size_t chunk_count = m_chunks.size() - first_chunk;
+
+    std::unique_ptr<CompletionFrontier> frontier;
+    if (m_options.progress && chunk_count > 0) {
+        frontier = std::make_unique<CompletionFrontier>(chunk_count, [&](size_t chunks) {
+            const size_t bytes_done = m_chunks[first_chunk + chunks - 1].end - text_begin;
+            report_progress(m_data, VTKLoadProgress::INDEXING, bytes_done, text_end - text_begin);
+        });
+    }
+
+    parallel_for(chunk_count, [&](size_t c) {
+        TokenChunk& chunk = m_chunks[first_chunk + c];
+        chunk.tokens = count_tokens(chunk.begin, chunk.end);
+        if (frontier) {
+            frontier->complete(c);
+        }
+    });
+
+    // Token numbers continue from the text indexed before
+    size_t first_token = 0;
+    if (first_chunk > 0) {
+        first_token = m_chunks[first_chunk - 1].first_token + m_chunks[first_chunk - 1].tokens;
+    }
+    const size_t text_first_token = first_token;
+    for (size_t c = first_chunk; c < m_chunks.size(); c++) {
+        m_chunks[c].first_token = first_token;
+        first_token += m_chunks[c].tokens;
+    }
+    return text_first_token;
+}
+
+void VTKParser::parse_vti()
+{
+    const VTIHeader header = scan_vti(m_cur, m_end);
+    m_data.version = header.version;
+
+    const int* extent = header.whole_extent;
+    m_data.dimension = { extent[1] - extent[0] + 1, extent[3] - extent[2] + 1, extent[5] - extent[4] + 1 };
+    if (m_data.dimension.x < 1 || m_data.dimension.y < 1 || m_data.dimension.z < 1) {
+        throw std::runtime_error("ImageData has an empty WholeExtent.");
+    }
+    dbg("DIMENSIONS: [" << m_data.dimension.x << ", " <<  m_data.dimension.y << ", " << m_data.dimension.z << "]");
+
+    // Point (i, j, k) of the extent is at Origin + (i, j, k) * Spacing
+    m_data.spacing = { header.spacing[0], header.spacing[1], header.spacing[2] };
+    m_data.origin = {
+        header.origin[0] + extent[0] * header.spacing[0],
+        header.origin[1] + extent[2] * header.spacing[1],
+        header.origin[2] + extent[4] * header.spacing[2]
+    };
+
+    const size_t count = size_t(m_data.dimension.x) * m_data.dimension.y * m_data.dimension.z;
+    const bool swap = header.big_endian == host_is_little_endian();
+    for (const VTIArray& array : header.arrays) {
+        const std::string type = legacy_type(array.type);
+        if (array.components != 1 || type.empty()) {
+            // Vectors and integer ids are no scalar fields to show
+            dbg("Skipping array " << array.name << " of " << array.components << " " << array.type);
+            continue;
+        }
+
+        VTKFieldInfo info { array.name, long(count), type, 0, 0 };
+        info.big_endian = header.big_endian;
+        info.header_width = header.header_width;
+
+        if (array.format == VTIFormat::Ascii) {
+            info.first_token = index_tokens(array.text_begin, array.text_end);
+        } else if (array.format == VTIFormat::Binary) {
+            info.encoding = VTKEncoding::Base64;
+            info.offset = array.text_begin - m_file->data();
+        } else {
+            if (!header.appended || array.offset > size_t(m_end - header.appended)) {
+                throw std::runtime_error("Failed to find the appended data of array " + array.name);
+            }
+            const char* at = header.appended + array.offset;
+            info.offset = at - m_file->data();
+            if (header.appended_base64) {
+                info.encoding = VTKEncoding::Base64;
+            } else {
+                // The block size header is checked now, so loading can use the samples right away
+                if (size_t(m_end - at) < header.header_width) {
+                    throw std::runtime_error("VTK XML file ended too soon. Failed to find the values of array " + array.name);
+                }
+                const uint64_t bytes = header.header_width == 8 ? load_value<uint64_t>(at, swap) : load_value<uint32_t>(at, swap);
+                if (bytes != count * type_width(type) || size_t(m_end - at) - header.header_width < bytes) {
+                    throw std::runtime_error("Failed to find the values of array " + array.name);
+                }
+                info.encoding = VTKEncoding::Raw;
+                info.offset += header.header_width;
+            }
+        }
+
+        m_data.field_index.push_back(info);
+        m_data.fields.emplace_back();
+    }
+
+    if (m_data.field_index.empty()) {
+        throw std::runtime_error("VTK XML file has no scalar point data.");
+    }
+}
+
+const char* VTKParser::binary_values(const VTKFieldInfo& info, size_t count, std::vector<char>& decoded) const
+{
+    const size_t width = type_width(info.type);
+    const char* at = m_file->data() + info.offset;
+    if (info.encoding == VTKEncoding::Raw) {
+        if (size_t(m_end - at) < count * width) {
+            throw std::runtime_error("Failed to read the binary scalar field " + info.name);
+        }
+        return at;
+    }
+
+    // The block size header and the samples decode as one
+    decoded.resize(info.header_width + count * width);
+    decode_base64(at, m_end, decoded.data(), decoded.size());
+    const bool swap = info.big_endian == host_is_little_endian();
+    const uint64_t bytes = info.header_width == 8 ? load_value<uint64_t>(decoded.data(), swap) : load_value<uint32_t>(decoded.data(), swap);
+    if (bytes != info.count * width) {
+        throw std::runtime_error("Failed to read the binary scalar field " + info.name);
+    }
+    return decoded.data() + info.header_width;
+}
+
+void VTKParser::skip_values(const VTKFieldInfo& info)
+{
+    if (m_binary) {
+        const size_t width = type_width(info.type);
+        if (size_t(m_end - m_cur) < info.count * width) {
+            throw std::runtime_error("VTK file ended too soon. Failed to find the values of field " + info.name);
+        }
+        m_cur += info.count * width;
+        return;
+    }
+
+    // Jump to the token after the last value using the chunk index
+    m_token = info.first_token + info.count;
+    auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), m_token,
+            [](size_t token, const TokenChunk& chunk) { return token < chunk.first_token; });
+    if (it == m_chunks.begin()) {
+        m_cur = m_end;
+        return;
+    }
+    const TokenChunk& chunk = *(it - 1);
+    m_cur = skip_tokens(chunk.begin, chunk.end, m_token - chunk.first_token);
+}
+
+template<typename T>
+void VTKParser::read_ascii_values(const VTKFieldInfo& info, size_t begin, size_t count, T* out, T& out_min, T& out_max, const AdvanceCallback& on_advance)
+{
+    // The values are tokens [first_token + begin, first_token + begin + count) of the
+    // indexed FIELD block. Every chunk overlapping that range is parsed by a worker
+    // straight into its known offset of out, and the per-chunk min/max are reduced afterwards.
+    const size_t first = info.first_token + begin;
+    const size_t last = first + count;
+
+    if (count == 0) {
+        return;
+    }
+    if (m_chunks.empty() || m_chunks.back().first_token + m_chunks.back().tokens < last) {
+        throw std::runtime_error("Failed to parse the scalar field " + info.name);
+    }
+
+    auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), first,
+            [](size_t token, const TokenChunk& chunk) { return token < chunk.first_token; });
+    const size_t first_chunk = (it - m_chunks.begin()) - 1;
+
+    size_t chunk_count = 0;
+    while (first_chunk + chunk_count < m_chunks.size() && m_chunks[first_chunk + chunk_count].first_token < last) {
+        chunk_count++;
+    }
+
+    std::vector<T> chunk_min(chunk_count);
+    std::vector<T> chunk_max(chunk_count);
+
+    std::unique_ptr<CompletionFrontier> frontier;
+    if (on_advance) {
+        const char* bytes_begin = m_chunks[first_chunk].begin;
+        const size_t bytes_total = m_chunks[first_chunk + chunk_count - 1].end - bytes_begin;
+        frontier = std::make_unique<CompletionFrontier>(chunk_count, [&, bytes_begin, bytes_total](size_t chunks) {
+            const TokenChunk& chunk = m_chunks[first_chunk + chunks - 1];
+            on_advance(std::min(last, chunk.first_token + chunk.tokens) - first, chunk.end - bytes_begin, bytes_total);
+        });
+    }
+
+    parallel_for(chunk_count, [&](size_t c) {
+        const TokenChunk& chunk = m_chunks[first_chunk + c];
+        const size_t begin_token = std::max(first, chunk.first_token);
+        const size_t end_token = std::min(last, chunk.first_token + chunk.tokens);
+
+        const char* p = skip_tokens(chunk.begin, chunk.end, begin_token - chunk.first_token);
+        p = parse_values(p, chunk.end, end_token - begin_token, out + (begin_token - first), chunk_min[c], chunk_max[c]);
+        if (!p) {
+            throw std::runtime_error("Failed to parse the scalar field " + info.name);
+        }
+        if (frontier) {
+            frontier->complete(c);
+        }
+    });
+
+    out_min = *std::min_element(chunk_min.begin(), chunk_min.end());
+    out_max = *std::max_element(chunk_max.begin(), chunk_max.end());
+}
+
+template<typename T>
+void VTKParser::read_binary_values(const VTKFieldInfo& info, size_t begin, size_t count, T* out, T& out_min, T& out_max, const AdvanceCallback& on_advance)
+{
+    // The values are one contiguous block, in the file or decoded from base64.
+    const size_t width = type_width(info.type);
+    if (begin + count > size_t(info.count)) {
+        throw std::runtime_error("Failed to read the binary scalar field " + info.name);
+    }
+    std::vector<char> decoded;
+    const char* values = binary_values(info, begin + count, decoded) + begin * width;
+    const bool swap = info.big_endian == host_is_little_endian();
+
+    const size_t blocks = (count + BINARY_CHUNK_VALUES - 1) / BINARY_CHUNK_VALUES;
+    std::vector<T> block_min(blocks);
+    std::vector<T> block_max(blocks);
+
+    std::unique_ptr<CompletionFrontier> frontier;
+    if (on_advance) {
+        frontier = std::make_unique<CompletionFrontier>(blocks, [&](size_t done) {
+            const size_t values = std::min(count, done * BINARY_CHUNK_VALUES);
+            on_advance(values, values * width, count * width);
+        });
+    }
+
+    parallel_for(blocks, [&](size_t b) {
+        const size_t block_begin = b * BINARY_CHUNK_VALUES;
+        const size_t n = std::min(BINARY_CHUNK_VALUES, count - block_begin);
+        const char* in = values + block_begin * width;
+        T* block_out = out + block_begin;
+
+        if (info.type == "double") {
+            convert_minmax<double>(in, block_out, n, swap, block_min[b], block_max[b]);
+        } else if (info.type == "float") {
+            convert_minmax<float>(in, block_out, n, swap, block_min[b], block_max[b]);
+        } else if (info.type == "short") {
+            convert_minmax<short>(in, block_out, n, swap, block_min[b], block_max[b]);
+        } else {
+            convert_minmax<unsigned char>(in, block_out, n, swap, block_min[b], block_max[b]);
+        }
+        if (frontier) {
+            frontier->complete(b);
+        }
+    });
+
+    if (blocks > 0) {
+        out_min = *std::min_element(block_min.begin(), block_min.end());
+        out_max = *std::max_element(block_max.begin(), block_max.end());
+    }
+}
+
+template<typename T>
+void VTKParser::read_subgrid_ascii(VTKField<T>& field, const VTKFieldInfo& info, const AdvanceCallback& on_advance)
+{
+    // Text can't be seeked by value, so every chunk holding a kept slice walks
+    // its tokens, but only the kept ones are converted. Rows without kept
+    // samples are skipped whole, and chunks before the first or after the last
+    // kept sample, or wholly in skipped slices, are not touched at all.
+    const int stride = m_options.stride;
+    const Dimension& src = m_source_dimension;
+    const Dimension& dim = field.dimension;
+    const Dimension b = m_region.begin;
+    const Dimension e = { b.x + (dim.x - 1) * stride, b.y + (dim.y - 1) * stride, b.z + (dim.z - 1) * stride };
+    const size_t src_slice = size_t(src.x) * src.y;
+    const size_t out_slice = size_t(dim.x) * dim.y;
+    const size_t first = info.first_token;
+    const size_t last = info.first_token + info.count;
+
+    if (m_chunks.empty() || m_chunks.back().first_token + m_chunks.back().tokens < last) {
+        throw std::runtime_error("Failed to parse the scalar field " + info.name);
+    }
+
+    // Tokens of the first and one past the last kept sample
+    const size_t lo = first + (size_t(b.z) * src.y + b.y) * src.x + b.x;
+    const size_t hi = first + (size_t(e.z) * src.y + e.y) * src.x + e.x + 1;
+
+    auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), lo,
+            [](size_t token, const TokenChunk& chunk) { return token < chunk.first_token; });
+    const size_t first_chunk = (it - m_chunks.begin()) - 1;
+    size_t chunk_count = 0;
+    while (first_chunk + chunk_count < m_chunks.size() && m_chunks[first_chunk + chunk_count].first_token < hi) {
+        chunk_count++;
+    }
+
+    auto kept = [stride](size_t c, int c_first, int c_last) {
+        return c >= size_t(c_first) && c <= size_t(c_last) && (c - c_first) % stride == 0;
+    };
+
+    std::vector<T> chunk_min(chunk_count, std::numeric_limits<T>::max());
+    std::vector<T> chunk_max(chunk_count, std::numeric_limits<T>::lowest());
+
+    std::unique_ptr<CompletionFrontier> frontier;
+    if (on_advance) {
+        const char* bytes_begin = m_chunks[first_chunk].begin;
+        const size_t bytes_total = m_chunks[first_chunk + chunk_count - 1].end - bytes_begin;
+        frontier = std::make_unique<CompletionFrontier>(chunk_count, [&, bytes_begin, bytes_total](size_t chunks) {
+            const TokenChunk& chunk = m_chunks[first_chunk + chunks - 1];
+            size_t out_slices = dim.z;
+            if (chunks < chunk_count) {
+                // Kept slices that lie wholly before the chunk's end
+                const size_t src_slices = (std::min(hi, chunk.first_token + chunk.tokens) - first) / src_slice;
+                out_slices = src_slices <= size_t(b.z) ? 0 : std::min<size_t>((src_slices - b.z + stride - 1) / stride, dim.z);
+            }
+            on_advance(out_slices * out_slice, chunk.end - bytes_begin, bytes_total);
+        });
+    }
+
+    parallel_for(chunk_count, [&](size_t c) {
+        const TokenChunk& chunk = m_chunks[first_chunk + c];
+        const size_t begin = std::max(lo, chunk.first_token) - first;
+        const size_t end = std::min(hi, chunk.first_token + chunk.tokens) - first;
+
+        // First kept slice at or after the chunk's first value
+        const size_t z0 = std::max(begin / src_slice, size_t(b.z));
+        const size_t first_z = b.z + (z0 - b.z + stride - 1) / stride * stride;
+        if (first_z <= size_t(e.z) && first_z * src_slice < end) {
+            const char* p = skip_tokens(chunk.begin, chunk.end, first + begin - chunk.first_token);
+            size_t v = begin;
+            while (v < end) {
+                const size_t y = (v / src.x) % src.y;
+                const size_t z = v / src_slice;
+                const size_t row_end = std::min(end, v - v % src.x + src.x);
+                if (!kept(y, b.y, e.y) || !kept(z, b.z, e.z)) {
+                    p = skip_tokens(p, chunk.end, row_end - v);
+                    v = row_end;
+                    continue;
+                }
+                for (; v < row_end; v++) {
+                    const size_t x = v % src.x;
+                    if (!kept(x, b.x, e.x)) {
+                        p = skip_tokens(p, chunk.end, 1);
+                        continue;
+                    }
+                    T value, value_min, value_max;
+                    p = parse_values(p, chunk.end, 1, &value, value_min, value_max);
+                    if (!p) {
+                        throw std::runtime_error("Failed to parse the scalar field " + info.name);
+                    }
+                    field((x - b.x) / stride, (y - b.y) / stride, (z - b.z) / stride) = value;
+                    chunk_min[c] = std::min(chunk_min[c], value);
+                    chunk_max[c] = std::max(chunk_max[c], value);
+                }
+            }
+        }
+        if (frontier) {
+            frontier->complete(c);
+        }
+    });
+
+    field.min = *std::min_element(chunk_min.begin(), chunk_min.end());
+    field.max = *std::max_element(chunk_max.begin(), chunk_max.end());
+}
+
+template<typename T>
+void VTKParser::read_subgrid_binary(VTKField<T>& field, const VTKFieldInfo& info, const AdvanceCallback& on_advance)
+{
+    // Every kept row is at a known offset, so rows outside the region or
+    // skipped by the stride are never read
+    const int stride = m_options.stride;
+    const Dimension& src = m_source_dimension;
+    const Dimension& dim = field.dimension;
+    const Dimension b = m_region.begin;
+    const size_t width = type_width(info.type);
+    const size_t src_slice_bytes = size_t(src.x) * src.y * width;
+    const bool swap = info.big_endian == host_is_little_endian();
+
+    // Base64 text is decoded up to the last kept sample
+    const size_t last = (size_t(b.z + (dim.z - 1) * stride) * src.y + b.y + (dim.y - 1) * stride) * src.x + b.x + (dim.x - 1) * stride + 1;
+    std::vector<char> decoded;
+    const char* values = binary_values(info, last, decoded);
+    std::vector<T> slice_min(dim.z);
+    std::vector<T> slice_max(dim.z);
+
+    std::unique_ptr<CompletionFrontier> frontier;
+    if (on_advance) {
+        frontier = std::make_unique<CompletionFrontier>(dim.z, [&](size_t slices) {
+            // Counted up to the last kept slice read; the slices after it are skipped
+            const size_t bytes_total = info.count * width;
+            const size_t bytes_done = size_t(slices) == size_t(dim.z) ? bytes_total : (b.z + slices * stride) * src_slice_bytes;
+            on_advance(slices * dim.x * dim.y, bytes_done, bytes_total);
+        });
+    }
+
+    auto read_slices = [&](auto sample) {
+        using Src = decltype(sample);
+        parallel_for(dim.z, [&](size_t k) {
+            T vmin = std::numeric_limits<T>::max();
+            T vmax = std::numeric_limits<T>::lowest();
+            const size_t z = b.z + k * stride;
+            for (int j = 0; j < dim.y; j++) {
+                const char* row = values + ((z * src.y + b.y + size_t(j) * stride) * src.x + b.x) * width;
+                if (stride == 1) {
+                    // A cropped row is contiguous, so it converts like a whole field
+                    T row_min, row_max;
+                    convert_minmax<Src>(row, &field(0, j, k), dim.x, swap, row_min, row_max);
+                    vmin = std::min(vmin, row_min);
+                    vmax = std::max(vmax, row_max);
+                    continue;
+                }
+                for (int i = 0; i < dim.x; i++) {
+                    const T value = T(load_value<Src>(row + size_t(i) * stride * width, swap));
+                    field(i, j, k) = value;
+                    vmin = std::min(vmin, value);
+                    vmax = std::max(vmax, value);
+                }
+            }
+            slice_min[k] = vmin;
+            slice_max[k] = vmax;
+            if (frontier) {
+                frontier->complete(k);
+            }
+        });
+    };
+
+    if (info.type == "double") {
+        read_slices(double());
+    } else if (info.type == "float") {
+        read_slices(float());
+    } else if (info.type == "short") {
+        read_slices(short());
+    } else {
+        read_slices((unsigned char)0);
+    }
+
+    field.min = *std::min_element(slice_min.begin(), slice_min.end());
+    field.max = *std::max_element(slice_max.begin(), slice_max.end());
+}
+
 bool VTKParser::get_line(std::string& line)
 {
-    bool ret = false;
-    while (line == "" && (ret = !!std::getline(*m_is, line)));
-    return ret;
+    while (line == "" && m_cur < m_end) {
+        const char* eol = static_cast<const char*>(std::memchr(m_cur, '\n', m_end - m_cur));
+        const char* next = eol ? eol + 1 : m_end;
+        if (!eol) {
+            eol = m_end;
+        }
+        if (eol > m_cur && eol[-1] == '\r') {
+            eol--;
+        }
+
+        line.assign(m_cur, eol);
+        m_cur = next;
+        // Blank lines are skipped, like the rest of a data line after its
+        // last value, which VTK's writer ends with a space
+        if (line.find_first_not_of(" \t\f\v") == std::string::npos) {
+            line.clear();
+        }
+    }
+    return line != "";
 }
 
+#define INSTANTIATE_READ_SLAB(T) \
+    template void VTKParser::read_slab<T>(const VTKData&, size_t, int, int, T*, T&, T&);
 
+INSTANTIATE_READ_SLAB(double)
+INSTANTIATE_READ_SLAB(float)
+INSTANTIATE_READ_SLAB(short)
+INSTANTIATE_READ_SLAB(unsigned char)
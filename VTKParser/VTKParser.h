@@ -4,47 +4,182 @@
 #include <iostream>
 #include <filesystem>
 #include <memory>
+#include <optional>
+#include <utility>
+#include <variant>
 #include <vector>
 
+#include "FieldStats.h"
+#include "MappedFile.h"
+#include "SampleBuffer.h"
+
 namespace fs = std::filesystem;
 
 struct Dimension { int x; int y; int z;};
 struct Origin { float x; float y; float z;};
 struct Spacing { float x; float y; float z;};
 
+// The grid points [begin, begin + size) along each axis
+struct VTKRegion {
+    Dimension begin;
+    Dimension size;
+};
+
 template<typename T>
 struct VTKField {
     std::string name;
     Dimension dimension;
     Spacing spacing;
-    std::vector<T> data;
+    SampleBuffer<T> data;
     T min, max;
+    // Filled on first use by field_stats(), or while loading with VTKParseOptions::stats
+    std::shared_ptr<const VTKFieldStats> stats;
 
     T &operator()(size_t x, size_t y, size_t z) {
         return data[x + y * dimension.x + z * dimension.x * dimension.y];
     }
 
+    const T &operator()(size_t x, size_t y, size_t z) const {
+        return data[x + y * dimension.x + z * dimension.x * dimension.y];
+    }
+
     T* ptr()
     {
         return data.data();
     }
 
-    T min_val()
+    T min_val() const
     {
         return min;
     }
 
-    T max_val()
+    T max_val() const
     {
         return max;
     }
 
-    VTKField(std::string& name, Dimension d, Spacing s);
+    VTKField() = default;
+    VTKField(const std::string& name, Dimension d, Spacing s);
 };
 
 template<typename T>
-VTKField<T>::VTKField(std::string& a_name, Dimension d, Spacing s)
-    : name(a_name), data(d.x * d.y * d.z), dimension(d), spacing(s) {}
+VTKField<T>::VTKField(const std::string& a_name, Dimension d, Spacing s)
+    : name(a_name), data(size_t(d.x) * d.y * d.z), dimension(d), spacing(s) {}
+
+// A field kept in one of the sample types the parser can store
+using VTKFieldVariant = std::variant<VTKField<double>, VTKField<float>, VTKField<short>, VTKField<unsigned char>>;
+
+// Sample range of a field, whatever its storage type
+inline std::pair<double, double> field_range(const VTKFieldVariant& field)
+{
+    return std::visit([](const auto& f) { return std::pair<double, double>(f.min, f.max); }, field);
+}
+
+// Statistics of a field. Computed on first use and kept on the field, so later
+// calls cost nothing. Reset `stats` after changing a field's samples.
+template<typename T>
+const VTKFieldStats& field_stats(VTKField<T>& field)
+{
+    if (!field.stats) {
+        field.stats = std::make_shared<const VTKFieldStats>(
+                compute_stats(field.data.data(), field.data.size(), double(field.min), double(field.max)));
+    }
+    return *field.stats;
+}
+
+inline const VTKFieldStats& field_stats(VTKFieldVariant& field)
+{
+    return std::visit([](auto& f) -> const VTKFieldStats& { return field_stats(f); }, field);
+}
+
+// 1st to 99th percentile of a field, a range that single outliers can't stretch
+inline std::pair<double, double> robust_range(VTKFieldVariant& field)
+{
+    const VTKFieldStats& stats = field_stats(field);
+    return { stats.p01, stats.p99 };
+}
+
+enum class VTKEncoding {
+    Ascii,  // Whitespace separated text, found through VTKFieldInfo::first_token
+    Raw,    // Packed samples at VTKFieldInfo::offset
+    Base64  // Base64 text at VTKFieldInfo::offset, of a block size header and the packed samples
+};
+
+// Where a field's samples live in the source file, recorded by the first scan.
+struct VTKFieldInfo {
+    std::string name;
+    long count;
+    std::string type;
+    size_t offset;      // Byte offset of the first sample
+    size_t first_token; // Token index of the first sample within the indexed text
+    VTKEncoding encoding = VTKEncoding::Ascii;
+    bool big_endian = true;  // Legacy binary files always are
+    size_t header_width = 0; // Bytes of the block size header of Base64 samples
+};
+
+enum class VTKStorage {
+    Native, // Keep the sample type declared by the file (double, float, short or unsigned_char)
+    Float,  // Store every field as float
+    Double  // Widen every field to double
+};
+
+// Reported while a file is loaded
+struct VTKLoadProgress {
+    // Field being parsed, an index into VTKData::field_index, or INDEXING
+    // while the first scan indexes an ASCII FIELD block
+    static constexpr size_t INDEXING = size_t(-1);
+    size_t field;
+    size_t bytes_done;
+    size_t bytes_total;
+    // Grid of the file, known once the header is read
+    Dimension dimension;
+    Spacing spacing;
+};
+
+using VTKProgressCallback = std::function<void(const VTKLoadProgress&)>;
+
+enum class VTKCacheCodec {
+    Raw,      // Samples as they are in memory; opening the cache maps them without a copy
+    Lossless, // Shuffled and run-length encoded blocks (see BlockCodec.h)
+    Lossy     // Like Lossless, but floating point samples are quantized to within cache_error_bound
+};
+
+struct VTKParseOptions {
+    // Only index the fields up front. Each field is parsed on its first VTKData::field() call.
+    bool lazy = false;
+    VTKStorage storage = VTKStorage::Native;
+    // Open from, and after parsing write, a binary cache next to the source file (see VTKCache).
+    bool cache = true;
+    VTKCacheCodec cache_codec = VTKCacheCodec::Raw;
+    // Largest absolute error per sample allowed by VTKCacheCodec::Lossy
+    double cache_error_bound = 0.0;
+    // Compute every field's statistics (see field_stats) right after it is loaded
+    bool stats = false;
+    // Keep only every stride-th sample along each axis, for a quick preview of a
+    // large grid. VTKData::dimension shrinks and VTKData::spacing grows to match.
+    // Skipped samples are never converted, and skipped slices of a binary file
+    // are never read.
+    int stride = 1;
+    // Load only this box of the file's grid; VTKData::origin moves to its first
+    // point. With a stride, the kept samples are counted from that point.
+    // Binary files and caches are read row by row, so the bytes of samples
+    // outside the box are never touched. An ASCII file is still scanned.
+    std::optional<VTKRegion> region;
+    // Called from the parser's worker threads, one call at a time, as the
+    // bytes of each field (and of the index scan) are consumed
+    VTKProgressCallback progress;
+
+    // Whether every sample of the file is loaded. Only such loads write the cache.
+    bool full_grid() const
+    {
+        return stride == 1 && !region;
+    }
+};
+
+class VTKParser;
+
+// Receives the number of leading z-slices of a field whose samples are all in place.
+using VTKSliceCallback = std::function<void(int slices)>;
 
 struct VTKData {
     std::string version;
@@ -52,14 +187,61 @@ struct VTKData {
     Dimension dimension;
     Origin origin;
     Spacing spacing;
-    std::vector<VTKField<double>> fields;
+    std::vector<VTKFieldInfo> field_index;
+    // Parallel to field_index. A field has no data until it is loaded.
+    std::vector<VTKFieldVariant> fields;
+
+    // Returns the i-th field, parsing it first if it has not been loaded yet.
+    VTKFieldVariant& field(size_t i);
+    bool is_loaded(size_t i) const;
+
+    // Loads the i-th field like field(), but reports progress while it is parsed.
+    // on_slices is called from the parser's worker threads, one call at a time
+    // and with an increasing slice count. fields[i] holds the field's storage
+    // before the first call, so complete slices can be read while parsing goes on.
+    // If parsing throws, fields[i] is left partly filled; reset it to an empty
+    // VTKFieldVariant once nothing reads it anymore.
+    void stream_field(size_t i, const VTKSliceCallback& on_slices);
+
+    // Keeps the mapped source file alive for lazily loaded fields.
+    std::shared_ptr<VTKParser> loader;
 };
 
 class VTKParser {
 public:
-    static VTKData from_file(const fs::path& filepath);
+    // Reads a legacy STRUCTURED_POINTS file, or a VTK XML ImageData (.vti)
+    // file with ascii, base64 or raw appended arrays. Raw samples that are
+    // already in the stored type and host byte order are viewed in the mapped
+    // file instead of copied.
+    static VTKData from_file(const fs::path& filepath, const VTKParseOptions& options = {});
+
+    // Index into VTKFieldVariant of the type a field declared as `type` is stored as.
+    static size_t storage_index(const std::string& type, VTKStorage storage);
+
+    // Shrinks the geometry of a whole grid in `data` to the samples that
+    // options.region and options.stride keep. Returns the region in points of
+    // the whole grid; throws if it is empty or sticks out of the grid.
+    static VTKRegion select_subgrid(VTKData& data, const VTKParseOptions& options);
+
+    void load_field(VTKData& data, size_t i, const VTKSliceCallback& on_slices = {});
+
+    // Parses z-slices [z, z + slices) of the i-th field into out, without loading the rest
+    template<typename T>
+    void read_slab(const VTKData& data, size_t i, int z, int slices, T* out, T& out_min, T& out_max);
+
+    const fs::path& path() const;
+    const VTKParseOptions& options() const;
 private:
-    VTKParser(std::unique_ptr<std::istream>);
+    // A newline aligned slice of an ASCII FIELD block. Tokens never straddle
+    // two chunks, so chunks can be counted and parsed independently.
+    struct TokenChunk {
+        const char* begin;
+        const char* end;
+        size_t first_token;
+        size_t tokens;
+    };
+
+    VTKParser(const fs::path& filepath, const VTKParseOptions& options);
 
     VTKData parse();
     
@@ -69,9 +251,39 @@ private:
     void parse_geomtype();
     void parse_data();
     void parse_field();
+    void parse_vti();
+    // Splits the text [begin, end) into chunks and appends them to the index.
+    // Returns the index of its first token.
+    size_t index_tokens(const char* begin, const char* end);
+    void skip_values(const VTKFieldInfo& info);
+    template<typename T> void load_field_as(VTKData& data, size_t i, const VTKSliceCallback& on_slices);
+    template<typename T> bool view_field(VTKField<T>& field, const VTKFieldInfo& info);
+    // Packed samples of a Raw or Base64 field, up to value `count`. Base64
+    // text is decoded into `decoded`.
+    const char* binary_values(const VTKFieldInfo& info, size_t count, std::vector<char>& decoded) const;
+    // on_advance(values, bytes_done, bytes_total) reports the leading samples that are in place
+    using AdvanceCallback = std::function<void(size_t values, size_t bytes_done, size_t bytes_total)>;
+    // Read values [begin, begin + count) of a field into out
+    template<typename T> void read_ascii_values(const VTKFieldInfo& info, size_t begin, size_t count, T* out, T& out_min, T& out_max, const AdvanceCallback& on_advance);
+    template<typename T> void read_binary_values(const VTKFieldInfo& info, size_t begin, size_t count, T* out, T& out_min, T& out_max, const AdvanceCallback& on_advance);
+    // Read every m_options.stride-th sample of m_region along each axis into field
+    template<typename T> void read_subgrid_ascii(VTKField<T>& field, const VTKFieldInfo& info, const AdvanceCallback& on_advance);
+    template<typename T> void read_subgrid_binary(VTKField<T>& field, const VTKFieldInfo& info, const AdvanceCallback& on_advance);
+    void report_progress(const VTKData& data, size_t field, size_t bytes_done, size_t bytes_total) const;
     
     bool get_line(std::string& line);
 private:
-    std::unique_ptr<std::istream> m_is;
+    fs::path m_path;
+    std::shared_ptr<MappedFile> m_file;
+    const char* m_cur;
+    const char* m_end;
+    std::vector<TokenChunk> m_chunks;
+    size_t m_token = 0;
+    VTKParseOptions m_options;
     VTKData m_data;
+    // Grid of the file, and the part of it that is loaded; m_data.dimension
+    // is smaller when decimating or loading a region
+    Dimension m_source_dimension;
+    VTKRegion m_region;
+    bool m_binary = false;
 };
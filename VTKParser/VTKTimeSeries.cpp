@@ -0,0 +1,253 @@
+#include "VTKTimeSeries.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+// Compares runs of digits by their value, everything else character by character
+static bool natural_less(const std::string& a, const std::string& b)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (std::isdigit((unsigned char)a[i]) && std::isdigit((unsigned char)b[j])) {
+            size_t a_end = i;
+            size_t b_end = j;
+            while (a_end < a.size() && std::isdigit((unsigned char)a[a_end])) a_end++;
+            while (b_end < b.size() && std::isdigit((unsigned char)b[b_end])) b_end++;
+
+            // Skip leading zeros, then the longer number is larger
+            while (i + 1 < a_end && a[i] == '0') i++;
+            while (j + 1 < b_end && b[j] == '0') j++;
+            if (a_end - i != b_end - j) {
+                return a_end - i < b_end - j;
+            }
+            int cmp = a.compare(i, a_end - i, b, j, b_end - j);
+            if (cmp != 0) {
+                return cmp < 0;
+            }
+            i = a_end;
+            j = b_end;
+        } else {
+            if (a[i] != b[j]) {
+                return a[i] < b[j];
+            }
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+std::vector<fs::path> VTKTimeSeries::expand_pattern(const fs::path& pattern)
+{
+    const std::string name = pattern.filename().string();
+    const size_t star = name.find('*');
+    if (star == std::string::npos) {
+        return { pattern };
+    }
+
+    const std::string prefix = name.substr(0, star);
+    const std::string suffix = name.substr(star + 1);
+    fs::path dir = pattern.parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        const std::string candidate = entry.path().filename().string();
+        if (entry.is_regular_file() &&
+            candidate.size() >= prefix.size() + suffix.size() &&
+            candidate.compare(0, prefix.size(), prefix) == 0 &&
+            candidate.compare(candidate.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end(), [](const fs::path& a, const fs::path& b) {
+        return natural_less(a.filename().string(), b.filename().string());
+    });
+
+    if (files.empty()) {
+        throw std::runtime_error("No files match " + pattern.string());
+    }
+    return files;
+}
+
+static size_t sample_bytes(const VTKData& data)
+{
+    size_t bytes = 0;
+    for (const auto& field : data.fields) {
+        std::visit([&](const auto& f) { bytes += f.data.size() * sizeof(f.data[0]); }, field);
+    }
+    return bytes;
+}
+
+VTKTimeSeries::VTKTimeSeries(std::vector<fs::path> files, const VTKTimeSeriesOptions& options)
+    : m_files(std::move(files)), m_options(options)
+{
+    if (m_files.empty()) {
+        throw std::runtime_error("A time series needs at least one file.");
+    }
+    m_options.parse.lazy = false;
+    m_thread = std::thread(&VTKTimeSeries::run, this);
+}
+
+VTKTimeSeries::~VTKTimeSeries()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake_loader.notify_all();
+    m_loaded.notify_all();
+    m_thread.join();
+}
+
+size_t VTKTimeSeries::size() const
+{
+    return m_files.size();
+}
+
+const fs::path& VTKTimeSeries::path(size_t t) const
+{
+    return m_files.at(t);
+}
+
+void VTKTimeSeries::set_current(size_t t)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_current = std::min(t, m_files.size() - 1);
+    }
+    m_wake_loader.notify_all();
+}
+
+std::optional<VTKData> VTKTimeSeries::try_get(size_t t)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_ring.find(t);
+    if (it == m_ring.end() || !it->second.data) {
+        return std::nullopt;
+    }
+    return share(it->second.data);
+}
+
+VTKData VTKTimeSeries::get(size_t t)
+{
+    if (t >= m_files.size()) {
+        throw std::out_of_range("Timestep out of range.");
+    }
+    set_current(t);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_loaded.wait(lock, [&]() { return m_stop || m_ring.count(t) != 0; });
+    auto it = m_ring.find(t);
+    if (it == m_ring.end()) {
+        throw std::runtime_error("Time series was closed.");
+    }
+    if (it->second.error) {
+        std::rethrow_exception(it->second.error);
+    }
+    return share(it->second.data);
+}
+
+// Timesteps to keep loaded, in the order they should be loaded in: the
+// current one, then alternating forward and backward, nearest first.
+std::vector<size_t> VTKTimeSeries::window() const
+{
+    std::vector<size_t> order = { m_current };
+    for (size_t d = 1; d <= std::max(m_options.ahead, m_options.behind); d++) {
+        if (d <= m_options.ahead && m_current + d < m_files.size()) {
+            order.push_back(m_current + d);
+        }
+        if (d <= m_options.behind && d <= m_current) {
+            order.push_back(m_current - d);
+        }
+    }
+    return order;
+}
+
+void VTKTimeSeries::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+        const std::vector<size_t> order = window();
+
+        for (auto it = m_ring.begin(); it != m_ring.end();) {
+            if (std::find(order.begin(), order.end(), it->first) == order.end()) {
+                m_bytes -= it->second.bytes;
+                it = m_ring.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        // Over budget, e.g. after a larger timestep came in: drop the least wanted first
+        for (size_t k = order.size() - 1; k > 0 && m_bytes > m_options.memory_budget; k--) {
+            auto it = m_ring.find(order[k]);
+            if (it != m_ring.end()) {
+                m_bytes -= it->second.bytes;
+                m_ring.erase(it);
+            }
+        }
+
+        // Assume the next timestep is as large as the largest one so far
+        size_t next = m_files.size();
+        for (size_t k = 0; k < order.size(); k++) {
+            if (m_ring.count(order[k]) != 0) {
+                continue;
+            }
+            if (k == 0 || m_bytes + m_largest <= m_options.memory_budget) {
+                next = order[k];
+            }
+            break;
+        }
+        if (next == m_files.size()) {
+            m_wake_loader.wait(lock);
+            continue;
+        }
+
+        lock.unlock();
+        Entry entry;
+        try {
+            entry.data = std::make_shared<VTKData>(VTKParser::from_file(m_files[next], m_options.parse));
+            entry.bytes = sample_bytes(*entry.data);
+        } catch (...) {
+            entry.error = std::current_exception();
+        }
+        lock.lock();
+
+        m_bytes += entry.bytes;
+        m_largest = std::max(m_largest, entry.bytes);
+        m_ring[next] = std::move(entry);
+        m_loaded.notify_all();
+    }
+}
+
+// The fields of the copy view the samples of `data` and share its ownership
+VTKData VTKTimeSeries::share(const std::shared_ptr<VTKData>& data)
+{
+    VTKData view;
+    view.version = data->version;
+    view.title = data->title;
+    view.dimension = data->dimension;
+    view.origin = data->origin;
+    view.spacing = data->spacing;
+    view.field_index = data->field_index;
+
+    for (auto& field : data->fields) {
+        std::visit([&](auto& f) {
+            using Field = std::decay_t<decltype(f)>;
+            Field shared;
+            shared.name = f.name;
+            shared.dimension = f.dimension;
+            shared.spacing = f.spacing;
+            shared.data = decltype(f.data)(f.data.data(), f.data.size(), data);
+            shared.min = f.min;
+            shared.max = f.max;
+            shared.stats = f.stats;
+            view.fields.emplace_back(std::move(shared));
+        }, field);
+    }
+    return view;
+}
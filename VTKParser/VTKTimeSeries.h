@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "VTKParser.h"
+
+struct VTKTimeSeriesOptions {
+    // Timesteps after and before the current one that are kept loaded
+    size_t ahead = 2;
+    size_t behind = 1;
+    // Bytes of samples the loaded timesteps may take up. The current timestep
+    // is always loaded, even if it alone is over budget.
+    size_t memory_budget = size_t(1) << 30;
+    // Options for every timestep. `lazy` is ignored: timesteps are parsed whole.
+    VTKParseOptions parse;
+};
+
+// One VTK file per timestep. A background thread keeps a window of timesteps
+// around the current one parsed, nearest first, so stepping through time
+// finds them ready.
+class VTKTimeSeries {
+public:
+    // The file name of `pattern` may contain one '*'. The matching files are
+    // returned in natural order, so step_9 comes before step_10.
+    static std::vector<fs::path> expand_pattern(const fs::path& pattern);
+
+    explicit VTKTimeSeries(std::vector<fs::path> files, const VTKTimeSeriesOptions& options = {});
+    ~VTKTimeSeries();
+
+    VTKTimeSeries(const VTKTimeSeries&) = delete;
+    VTKTimeSeries& operator=(const VTKTimeSeries&) = delete;
+
+    size_t size() const;
+    const fs::path& path(size_t t) const;
+
+    // Moves the prefetch window to be centered on timestep t
+    void set_current(size_t t);
+
+    // Timestep t if it is already loaded. The returned fields view the loaded
+    // samples and keep them alive, so this is cheap even for large files.
+    std::optional<VTKData> try_get(size_t t);
+
+    // Makes t the current timestep and waits until it is loaded. Rethrows the
+    // error if t failed to load.
+    VTKData get(size_t t);
+
+private:
+    struct Entry {
+        std::shared_ptr<VTKData> data;
+        std::exception_ptr error;
+        size_t bytes = 0;
+    };
+
+    void run();
+    std::vector<size_t> window() const;
+    static VTKData share(const std::shared_ptr<VTKData>& data);
+
+    std::vector<fs::path> m_files;
+    VTKTimeSeriesOptions m_options;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake_loader;
+    std::condition_variable m_loaded;
+    std::map<size_t, Entry> m_ring;
+    size_t m_current = 0;
+    size_t m_bytes = 0;
+    size_t m_largest = 0;
+    bool m_stop = false;
+
+    std::thread m_thread;
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts the heap allocations of the whole program, on every thread, by
+// replacing the global operator new. It is only built into targets that list
+// AllocationCounter.cpp, so the others keep the standard allocator untouched.
+
+// Allocations through operator new since the program started
+size_t allocation_count();
@@ -0,0 +1,405 @@
+#include "AllocationCounter.h"
+#include "CacheCounter.h"
+#include "SyntheticField.h"
+
+#include <IncrementalSurface.h>
+#include <MarchingCubes.h>
+#include <Parallel.h>
+#include <VTKParser.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+
+// Times the parser and the marching cubes kernels on generated fields, counts
+// the heap allocations and, where the system allows, the cache misses of each
+// run (see AllocationCounter.h and CacheCounter.h) and writes the results as
+// JSON, so runs of different versions can be diffed.
+//
+// Benchmark [--sizes 64,128] [--kernel-sizes 512] [--shapes sphere,gyroid,noise]
+//           [--warmup N] [--repetitions N] [--dir DIR] [--json FILE] [--keep]
+//
+// --kernel-sizes runs only the kernels, on fields made in memory, for sizes
+// too large to write and parse as files. At 512^3 the slices outgrow the
+// caches, which is where the cache misses of the traversal show.
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchmarkConfig {
+    std::vector<int> sizes = {64, 128};
+    std::vector<int> kernel_sizes;
+    std::vector<SyntheticShape> shapes = {SyntheticShape::Sphere, SyntheticShape::Gyroid, SyntheticShape::Noise};
+    int warmup = 1;
+    int repetitions = 5;
+    // Where the generated files go; they are removed afterwards unless `keep`
+    fs::path dir = fs::temp_directory_path();
+    fs::path json;
+    bool keep = false;
+};
+
+struct Timing {
+    double median = 0.0;
+    double p95 = 0.0;
+    double min = 0.0;
+    // Heap allocations of a timed run, on any thread
+    double allocations = 0.0;
+    // Cache misses of a timed run, on any thread, or -1 if they cannot be counted
+    double cache_misses = -1.0;
+    double l1d_misses = -1.0;
+};
+
+struct BenchmarkResult {
+    std::string benchmark;
+    std::string shape;
+    std::string encoding;
+    int size = 0;
+    // Bytes or cells processed by one run
+    double work = 0.0;
+    const char* unit = "";
+    Timing timing;
+    size_t triangles = 0;
+};
+
+// Runs `run` warmup times untimed, then repetitions times timed
+static Timing measure(int warmup, int repetitions, const std::function<void()>& run)
+{
+    for (int i = 0; i < warmup; i++) {
+        run();
+    }
+
+    std::vector<double> seconds;
+    seconds.reserve(repetitions);
+    size_t allocations = 0;
+    const CacheCounter last_level(CacheCounter::Event::LastLevel);
+    const CacheCounter l1d(CacheCounter::Event::L1Data);
+    uint64_t cache_misses = 0;
+    uint64_t l1d_misses = 0;
+    for (int i = 0; i < repetitions; i++) {
+        const size_t allocations_before = allocation_count();
+        const uint64_t cache_misses_before = last_level.read();
+        const uint64_t l1d_misses_before = l1d.read();
+        auto start = Clock::now();
+        run();
+        seconds.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+        allocations += allocation_count() - allocations_before;
+        cache_misses += last_level.read() - cache_misses_before;
+        l1d_misses += l1d.read() - l1d_misses_before;
+    }
+    std::sort(seconds.begin(), seconds.end());
+
+    // Nearest rank percentiles
+    auto percentile = [&](double p) {
+        size_t rank = size_t(std::ceil(p * seconds.size()));
+        return seconds[std::clamp(rank, size_t(1), seconds.size()) - 1];
+    };
+
+    Timing timing;
+    timing.median = seconds.size() % 2 == 1
+        ? seconds[seconds.size() / 2]
+        : (seconds[seconds.size() / 2 - 1] + seconds[seconds.size() / 2]) / 2.0;
+    timing.p95 = percentile(0.95);
+    timing.min = seconds.front();
+    timing.allocations = double(allocations) / repetitions;
+    if (last_level.available()) {
+        timing.cache_misses = double(cache_misses) / repetitions;
+    }
+    if (l1d.available()) {
+        timing.l1d_misses = double(l1d_misses) / repetitions;
+    }
+    return timing;
+}
+
+static double throughput(const BenchmarkResult& result)
+{
+    double per_second = result.work / result.timing.median;
+    return std::strcmp(result.unit, "MB/s") == 0 ? per_second / (1024.0 * 1024.0) : per_second;
+}
+
+static void print_result(const BenchmarkResult& result)
+{
+    std::cerr << result.benchmark << " " << result.shape << " " << result.size << "^3";
+    if (!result.encoding.empty()) {
+        std::cerr << " " << result.encoding;
+    }
+    std::cerr << ": median " << result.timing.median * 1e3 << " ms"
+        << ", p95 " << result.timing.p95 * 1e3 << " ms"
+        << ", " << throughput(result) << " " << result.unit
+        << ", " << result.timing.allocations << " allocations";
+    if (result.timing.cache_misses >= 0.0) {
+        std::cerr << ", " << result.timing.cache_misses << " cache misses";
+    }
+    if (result.timing.l1d_misses >= 0.0) {
+        std::cerr << ", " << result.timing.l1d_misses << " L1d misses";
+    }
+    std::cerr << "\n";
+}
+
+static void write_json(std::ostream& out, const BenchmarkConfig& config, const std::vector<BenchmarkResult>& results)
+{
+    out.precision(9);
+    out << "{\n"
+        << "  \"threads\": " << worker_count() << ",\n"
+        << "  \"warmup\": " << config.warmup << ",\n"
+        << "  \"repetitions\": " << config.repetitions << ",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& r = results[i];
+        out << "    {\"benchmark\": \"" << r.benchmark << "\""
+            << ", \"shape\": \"" << r.shape << "\""
+            << ", \"size\": " << r.size;
+        if (!r.encoding.empty()) {
+            out << ", \"encoding\": \"" << r.encoding << "\"";
+        }
+        if (r.benchmark.rfind("triangulate", 0) == 0) {
+            out << ", \"triangles\": " << r.triangles;
+        }
+        out << ", \"median_s\": " << r.timing.median
+            << ", \"p95_s\": " << r.timing.p95
+            << ", \"min_s\": " << r.timing.min
+            << ", \"allocations\": " << r.timing.allocations;
+        if (r.timing.cache_misses >= 0.0) {
+            out << ", \"cache_misses\": " << r.timing.cache_misses;
+        }
+        if (r.timing.l1d_misses >= 0.0) {
+            out << ", \"l1d_misses\": " << r.timing.l1d_misses;
+        }
+        out << ", \"throughput\": " << throughput(r)
+            << ", \"unit\": \"" << r.unit << "\"}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n"
+        << "}\n";
+}
+
+template<typename Parse>
+static void parse_list(const char* list, Parse&& parse)
+{
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            parse(item);
+        }
+    }
+}
+
+static BenchmarkConfig parse_arguments(int argc, char** argv)
+{
+    BenchmarkConfig config;
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--sizes") == 0 && has_value) {
+            config.sizes.clear();
+            parse_list(argv[++i], [&](const std::string& item) { config.sizes.push_back(std::stoi(item)); });
+        } else if (std::strcmp(argv[i], "--kernel-sizes") == 0 && has_value) {
+            config.kernel_sizes.clear();
+            parse_list(argv[++i], [&](const std::string& item) { config.kernel_sizes.push_back(std::stoi(item)); });
+        } else if (std::strcmp(argv[i], "--shapes") == 0 && has_value) {
+            config.shapes.clear();
+            parse_list(argv[++i], [&](const std::string& item) {
+                SyntheticShape shape;
+                if (!parse_shape(item, shape)) {
+                    throw std::runtime_error("Unknown shape " + item);
+                }
+                config.shapes.push_back(shape);
+            });
+        } else if (std::strcmp(argv[i], "--warmup") == 0 && has_value) {
+            config.warmup = std::stoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--repetitions") == 0 && has_value) {
+            config.repetitions = std::stoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--dir") == 0 && has_value) {
+            config.dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--json") == 0 && has_value) {
+            config.json = argv[++i];
+        } else if (std::strcmp(argv[i], "--keep") == 0) {
+            config.keep = true;
+        } else {
+            throw std::runtime_error(std::string("Unknown argument ") + argv[i]);
+        }
+    }
+    if (config.repetitions < 1) {
+        throw std::runtime_error("At least one repetition is needed.");
+    }
+    return config;
+}
+
+// Times the marching cubes kernels on one field
+template<typename T>
+static void run_kernels(const BenchmarkConfig& config, SyntheticShape shape, int n, VTKField<T>& field, std::vector<BenchmarkResult>& results)
+{
+    const double cells = double(n - 1) * (n - 1) * (n - 1);
+
+    BenchmarkResult gradient;
+    gradient.benchmark = "compute_gradient";
+    gradient.shape = shape_name(shape);
+    gradient.size = n;
+    gradient.work = cells;
+    gradient.unit = "cells/s";
+    gradient.timing = measure(config.warmup, config.repetitions, [&]() {
+        MarchingCubes::compute_gradient(field);
+    });
+    print_result(gradient);
+    results.push_back(gradient);
+
+    // Gradients a slice at a time along the way, with two slices of them
+    // resident per slab rather than the whole field's as below
+    BenchmarkResult triangulate;
+    triangulate.benchmark = "triangulate_field";
+    triangulate.shape = shape_name(shape);
+    triangulate.size = n;
+    triangulate.work = cells;
+    triangulate.unit = "cells/s";
+    triangulate.timing = measure(config.warmup, config.repetitions, [&]() {
+        triangulate.triangles = MarchingCubes::triangulate_field(field, 0.0).first.size() / 3;
+    });
+    print_result(triangulate);
+    results.push_back(triangulate);
+
+    // What an isovalue change costs once the field's gradients are kept
+    const GradientField gradients = MarchingCubes::compute_gradient(field);
+    BenchmarkResult isovalue;
+    isovalue.benchmark = "triangulate_cached_gradients";
+    isovalue.shape = shape_name(shape);
+    isovalue.size = n;
+    isovalue.work = cells;
+    isovalue.unit = "cells/s";
+    isovalue.timing = measure(config.warmup, config.repetitions, [&]() {
+        isovalue.triangles = MarchingCubes::triangulate_field(field, gradients, 0.0).first.size() / 3;
+    });
+    print_result(isovalue);
+    results.push_back(isovalue);
+
+    BenchmarkResult tree;
+    tree.benchmark = "minmax_tree";
+    tree.shape = shape_name(shape);
+    tree.size = n;
+    tree.work = cells;
+    tree.unit = "cells/s";
+    tree.timing = measure(config.warmup, config.repetitions, [&]() {
+        MinMaxTree::build(field);
+    });
+    print_result(tree);
+    results.push_back(tree);
+
+    // A whole extraction with cached gradients and ranges
+    const MinMaxTree ranges = MinMaxTree::build(field);
+    BenchmarkResult indexed;
+    indexed.benchmark = "triangulate_indexed";
+    indexed.shape = shape_name(shape);
+    indexed.size = n;
+    indexed.work = cells;
+    indexed.unit = "cells/s";
+    indexed.timing = measure(config.warmup, config.repetitions, [&]() {
+        indexed.triangles = MarchingCubes::triangulate_indexed(field, gradients, ranges, 0.0).indices.size() / 3;
+    });
+    print_result(indexed);
+    results.push_back(indexed);
+
+    // Dragging the isovalue back and forth by about one slider pixel.
+    // Neither isovalue is 0, which samples of the analytic shapes hit exactly.
+    const double step = (double(field.max) - double(field.min)) / 200.0;
+    IncrementalSurface surface;
+    surface.update(field, gradients, ranges, 0.5 * step);
+    int moves = 0;
+    BenchmarkResult incremental;
+    incremental.benchmark = "triangulate_incremental";
+    incremental.shape = shape_name(shape);
+    incremental.size = n;
+    incremental.work = cells;
+    incremental.unit = "cells/s";
+    incremental.timing = measure(config.warmup, config.repetitions, [&]() {
+        surface.update(field, gradients, ranges, (moves++ % 2 == 0 ? 1.5 : 0.5) * step);
+        // Drawn triangles, with the degenerate ones in the blocks' spare room
+        incremental.triangles = surface.index_count() / 3;
+    });
+    print_result(incremental);
+    results.push_back(incremental);
+}
+
+static void run_benchmarks(const BenchmarkConfig& config, std::vector<BenchmarkResult>& results)
+{
+    // The cache would turn the parser benchmark into a cache benchmark
+    VTKParseOptions options;
+    options.cache = false;
+
+    for (SyntheticShape shape : config.shapes) {
+        for (int n : config.sizes) {
+            const std::vector<float> samples = synthetic_field(shape, n);
+            VTKData binary_data;
+
+            for (bool binary : {false, true}) {
+                std::stringstream name;
+                name << "sfv_bench_" << shape_name(shape) << "_" << n << (binary ? "_binary" : "_ascii") << ".vtk";
+                const fs::path path = config.dir / name.str();
+                write_vtk(path, shape_name(shape), samples, n, binary);
+
+                BenchmarkResult result;
+                result.benchmark = "from_file";
+                result.shape = shape_name(shape);
+                result.encoding = binary ? "binary" : "ascii";
+                result.size = n;
+                result.work = double(fs::file_size(path));
+                result.unit = "MB/s";
+                VTKData data;
+                result.timing = measure(config.warmup, config.repetitions, [&]() {
+                    data = VTKParser::from_file(path, options);
+                });
+                print_result(result);
+                results.push_back(result);
+
+                if (binary) {
+                    binary_data = std::move(data);
+                }
+                if (!config.keep) {
+                    fs::remove(path);
+                }
+            }
+
+            // Both encodings hold the same samples, so the kernels run once
+            std::visit([&](auto& field) {
+                run_kernels(config, shape, n, field, results);
+            }, binary_data.fields.at(0));
+        }
+
+        for (int n : config.kernel_sizes) {
+            VTKField<float> field(shape_name(shape), {n, n, n}, {1.0f, 1.0f, 1.0f});
+            {
+                const std::vector<float> samples = synthetic_field(shape, n);
+                std::copy(samples.begin(), samples.end(), field.ptr());
+                const auto range = std::minmax_element(samples.begin(), samples.end());
+                field.min = *range.first;
+                field.max = *range.second;
+            }
+            run_kernels(config, shape, n, field, results);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        BenchmarkConfig config = parse_arguments(argc, argv);
+
+        std::vector<BenchmarkResult> results;
+        run_benchmarks(config, results);
+
+        if (config.json.empty()) {
+            write_json(std::cout, config, results);
+        } else {
+            std::ofstream out(config.json);
+            write_json(out, config, results);
+            if (!out) {
+                throw std::runtime_error("Could not write " + config.json.string());
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
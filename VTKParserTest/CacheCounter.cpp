@@ -0,0 +1,57 @@
+#include "CacheCounter.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+CacheCounter::CacheCounter(Event event)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    if (event == Event::LastLevel) {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    } else {
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    }
+    attr.inherit = 1;
+    // User space only, which unprivileged programs are allowed to count
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+CacheCounter::~CacheCounter()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+uint64_t CacheCounter::read() const
+{
+    uint64_t count = 0;
+    if (m_fd < 0 || ::read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    return count;
+}
+
+#else
+
+CacheCounter::CacheCounter(Event)
+{
+}
+
+CacheCounter::~CacheCounter() = default;
+
+uint64_t CacheCounter::read() const
+{
+    return 0;
+}
+
+#endif
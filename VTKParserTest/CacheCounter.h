@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts the hardware cache misses of the program with perf_event_open. The
+// threads a counter's thread starts while it is open are counted with it once
+// they exit, which parallel_for's threads have by the time it returns. Only
+// built for Linux; elsewhere, and where the kernel has no such counters or
+// does not let the program use them, a count is not available.
+class CacheCounter {
+public:
+    // Misses of the last level cache, and loads that missed the L1 data cache
+    enum class Event { LastLevel, L1Data };
+
+    explicit CacheCounter(Event event);
+    ~CacheCounter();
+    CacheCounter(const CacheCounter&) = delete;
+    CacheCounter& operator=(const CacheCounter&) = delete;
+
+    bool available() const { return m_fd >= 0; }
+    // Misses since the counter was opened, or 0 if it is not available
+    uint64_t read() const;
+
+private:
+    int m_fd = -1;
+};
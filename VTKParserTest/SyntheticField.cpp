@@ -0,0 +1,170 @@
+#include "SyntheticField.h"
+
+#include <ByteSwap.h>
+#include <Parallel.h>
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+const char* shape_name(SyntheticShape shape)
+{
+    switch (shape) {
+        case SyntheticShape::Sphere:
+            return "sphere";
+        case SyntheticShape::Gyroid:
+            return "gyroid";
+        case SyntheticShape::Noise:
+            return "noise";
+    }
+    return "unknown";
+}
+
+bool parse_shape(const std::string& name, SyntheticShape& shape)
+{
+    for (SyntheticShape candidate : {SyntheticShape::Sphere, SyntheticShape::Gyroid, SyntheticShape::Noise}) {
+        if (name == shape_name(candidate)) {
+            shape = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Value in [-1, 1] for a lattice point, from a 32 bit integer hash
+static float lattice_value(int x, int y, int z)
+{
+    uint32_t h = uint32_t(x) * 0x8da6b343u ^ uint32_t(y) * 0xd8163841u ^ uint32_t(z) * 0xcb1ab31fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return float(h) / float(UINT32_MAX) * 2.0f - 1.0f;
+}
+
+static float smooth(float t)
+{
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Trilinear interpolation of lattice values, `period` grid points apart
+static float value_noise(int x, int y, int z, int period)
+{
+    const int ix = x / period;
+    const int iy = y / period;
+    const int iz = z / period;
+    const float tx = smooth(float(x % period) / period);
+    const float ty = smooth(float(y % period) / period);
+    const float tz = smooth(float(z % period) / period);
+
+    float c[2][2];
+    for (int dz = 0; dz < 2; dz++) {
+        for (int dy = 0; dy < 2; dy++) {
+            const float v0 = lattice_value(ix, iy + dy, iz + dz);
+            const float v1 = lattice_value(ix + 1, iy + dy, iz + dz);
+            c[dz][dy] = v0 + (v1 - v0) * tx;
+        }
+    }
+    const float c0 = c[0][0] + (c[0][1] - c[0][0]) * ty;
+    const float c1 = c[1][0] + (c[1][1] - c[1][0]) * ty;
+    return c0 + (c1 - c0) * tz;
+}
+
+std::vector<float> synthetic_field(SyntheticShape shape, int n)
+{
+    if (n < 2) {
+        throw std::runtime_error("A synthetic field needs at least 2 points along each axis.");
+    }
+
+    std::vector<float> samples(size_t(n) * n * n);
+    const float center = (n - 1) / 2.0f;
+    const float radius = n / 3.0f;
+    const float frequency = 4.0f * 2.0f * float(M_PI) / n;
+
+    parallel_for(size_t(n), [&](size_t z) {
+        float* slice = samples.data() + z * n * n;
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                float v = 0.0f;
+                switch (shape) {
+                    case SyntheticShape::Sphere: {
+                        const float dx = x - center;
+                        const float dy = y - center;
+                        const float dz = float(z) - center;
+                        v = std::sqrt(dx * dx + dy * dy + dz * dz) - radius;
+                        break;
+                    }
+                    case SyntheticShape::Gyroid: {
+                        const float px = x * frequency;
+                        const float py = y * frequency;
+                        const float pz = float(z) * frequency;
+                        v = std::sin(px) * std::cos(py) + std::sin(py) * std::cos(pz) + std::sin(pz) * std::cos(px);
+                        break;
+                    }
+                    case SyntheticShape::Noise:
+                        // Two octaves, scaled back into [-1, 1]
+                        v = (value_noise(x, y, int(z), 16) + 0.5f * value_noise(x, y, int(z), 4)) / 1.5f;
+                        break;
+                }
+                slice[size_t(y) * n + x] = v;
+            }
+        }
+    });
+    return samples;
+}
+
+void write_vtk(const fs::path& path, const std::string& field_name, const std::vector<float>& samples, int n, bool binary)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Could not open " + path.string() + " for writing.");
+    }
+
+    out << "# vtk DataFile Version 3.0\n"
+        << "Synthetic " << field_name << " field\n"
+        << (binary ? "BINARY\n" : "ASCII\n")
+        << "DATASET STRUCTURED_POINTS\n"
+        << "DIMENSIONS " << n << " " << n << " " << n << "\n"
+        << "ORIGIN 0 0 0\n"
+        << "SPACING 1 1 1\n"
+        << "POINT_DATA " << samples.size() << "\n"
+        << "FIELD FieldData 1\n"
+        << field_name << " 1 " << samples.size() << " float\n";
+
+    // Written a slice at a time to keep the buffer small for large n
+    const size_t slice_values = size_t(n) * n;
+    std::vector<char> buffer;
+    for (size_t begin = 0; begin < samples.size(); begin += slice_values) {
+        buffer.clear();
+        if (binary) {
+            // Legacy VTK binary data is big endian
+            buffer.resize(slice_values * sizeof(float));
+            for (size_t i = 0; i < slice_values; i++) {
+                uint32_t bits;
+                std::memcpy(&bits, &samples[begin + i], sizeof(bits));
+                if (host_is_little_endian()) {
+                    bits = byteswap(bits);
+                }
+                std::memcpy(buffer.data() + i * sizeof(bits), &bits, sizeof(bits));
+            }
+        } else {
+            // Shortest round-tripping text, nine values per line
+            char text[32];
+            for (size_t i = 0; i < slice_values; i++) {
+                auto result = std::to_chars(text, text + sizeof(text), samples[begin + i]);
+                buffer.insert(buffer.end(), text, result.ptr);
+                buffer.push_back((begin + i) % 9 == 8 ? '\n' : ' ');
+            }
+        }
+        out.write(buffer.data(), buffer.size());
+    }
+    out << "\n";
+
+    if (!out) {
+        throw std::runtime_error("Could not write " + path.string() + ".");
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Analytic fields for benchmarks. Each is zero on an interesting surface, so
+// an isovalue of 0 gives a representative amount of triangles.
+enum class SyntheticShape {
+    Sphere,  // Signed distance to a sphere of radius n/3, in grid units
+    Gyroid,  // Triply periodic minimal surface, four periods along each axis
+    Noise    // Smooth value noise in [-1, 1], the same for a given n every run
+};
+
+const char* shape_name(SyntheticShape shape);
+// Returns false if name is not one of the names shape_name gives
+bool parse_shape(const std::string& name, SyntheticShape& shape);
+
+// Samples on an n x n x n grid with unit spacing, x varying fastest
+std::vector<float> synthetic_field(SyntheticShape shape, int n);
+
+// Writes the samples as a legacy STRUCTURED_POINTS file with one float field
+void write_vtk(const fs::path& path, const std::string& field_name, const std::vector<float>& samples, int n, bool binary);
@@ -1,6 +1,670 @@
 #include <VTKParser.h>
+#include <BlockCodec.h>
+#include <BrickedField.h>
+#include <ByteSwap.h>
+#include <VTKCache.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Round trips every field through the cache codec and reports how well it
+// compresses and how fast it decodes.
+template<typename T>
+static void bench_codec(const VTKField<T>& field, double error_bound)
+{
+    const size_t bytes = field.data.size() * sizeof(T);
+
+    auto start = Clock::now();
+    std::vector<char> encoded = encode_samples(field.data.data(), field.data.size(), error_bound);
+    double encode_seconds = seconds_since(start);
+
+    std::vector<T> decoded(field.data.size());
+    double decode_seconds = 1e30;
+    for (int run = 0; run < 5; run++) {
+        start = Clock::now();
+        decode_samples(encoded.data(), encoded.size(), decoded.data(), decoded.size());
+        decode_seconds = std::min(decode_seconds, seconds_since(start));
+    }
+
+    double max_error = 0.0;
+    for (size_t i = 0; i < decoded.size(); i++) {
+        max_error = std::max(max_error, std::abs(double(decoded[i]) - double(field.data[i])));
+    }
+
+    std::cout << "  " << field.name << ": ratio " << double(bytes) / encoded.size()
+        << ", encode " << bytes / encode_seconds / 1e9 << " GB/s"
+        << ", decode " << bytes / decode_seconds / 1e9 << " GB/s"
+        << ", max error " << max_error << "\n";
+}
+
+// Bytes of `values` in the given byte order, as a binary file holds them
+template<typename T>
+static std::string bytes_of(const std::vector<T>& values, bool big_endian)
+{
+    std::string bytes(values.size() * sizeof(T), '\0');
+    std::memcpy(bytes.data(), values.data(), bytes.size());
+    if (big_endian == host_is_little_endian()) {
+        for (size_t i = 0; i < bytes.size(); i += sizeof(T)) {
+            std::reverse(bytes.begin() + i, bytes.begin() + i + sizeof(T));
+        }
+    }
+    return bytes;
+}
+
+// Parses files the parser once got wrong, written to the temp directory, and
+// reports each check that fails. Returns the number of failures.
+static int run_checks()
+{
+    int failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        if (!ok) {
+            std::cerr << "Check failed: " << what << "\n";
+            failures++;
+        }
+    };
+
+    VTKParseOptions options;
+    options.cache = false;
+
+    // Several ASCII fields whose data lines end with a space, as VTK's own
+    // writer leaves them
+    {
+        const fs::path path = fs::temp_directory_path() / "sfv_check_trailing_blanks.vtk";
+        {
+            std::ofstream out(path, std::ios::binary);
+            out << "# vtk DataFile Version 3.0\ntrailing blanks\nASCII\nDATASET STRUCTURED_POINTS\n"
+                << "DIMENSIONS 3 3 3\nORIGIN 0 0 0\nSPACING 1 1 1\nPOINT_DATA 27\nFIELD FieldData 2\n";
+            for (int f = 0; f < 2; f++) {
+                out << "field" << f << " 1 27 float\n";
+                for (int i = 0; i < 27; i++) {
+                    out << i + 100 * f << (i % 9 == 8 ? " \n" : " ");
+                }
+            }
+        }
+        try {
+            VTKData data = VTKParser::from_file(path, options);
+            check(data.fields.size() == 2, "trailing blanks: both fields are found");
+            for (size_t f = 0; f < data.fields.size(); f++) {
+                const auto& field = std::get<VTKField<float>>(data.fields[f]);
+                bool same = field.data.size() == 27;
+                for (size_t i = 0; same && i < 27; i++) {
+                    same = field.data[i] == float(i + 100 * f);
+                }
+                check(same, "trailing blanks: samples of field" + std::to_string(f));
+            }
+        } catch (const std::exception& e) {
+            check(false, std::string("trailing blanks: ") + e.what());
+        }
+        fs::remove(path);
+    }
+
+    // A field out of core, over several bricks along each axis with only a
+    // few resident, reads the same boxes as the field in memory
+    {
+        const fs::path path = fs::temp_directory_path() / "sfv_check_bricked.vtk";
+        const Dimension dim = {70, 40, 35};
+        {
+            std::ofstream out(path, std::ios::binary);
+            out << "# vtk DataFile Version 3.0\nbricked\nASCII\nDATASET STRUCTURED_POINTS\n"
+                << "DIMENSIONS " << dim.x << " " << dim.y << " " << dim.z << "\nORIGIN 0 0 0\nSPACING 1 1 1\n"
+                << "POINT_DATA " << dim.x * dim.y * dim.z << "\nFIELD FieldData 1\n"
+                << "samples 1 " << dim.x * dim.y * dim.z << " float\n";
+            for (int i = 0; i < dim.x * dim.y * dim.z; i++) {
+                out << std::sin(0.1 * i) << (i % 9 == 8 ? "\n" : " ");
+            }
+            out << "\n";
+        }
+        fs::path bricks;
+        try {
+            const VTKData whole = VTKParser::from_file(path, options);
+            const auto& field = std::get<VTKField<float>>(whole.fields[0]);
+
+            VTKData index = open_index(path);
+            bricks = BrickedField<float>::path_for(path, 0);
+            const auto bricked = std::get<BrickedField<float>>(open_bricked(index, 0, 3 * BRICK_VALUES * sizeof(float)));
+            check(bricked.min == field.min && bricked.max == field.max, "bricked: sample range");
+
+            // The whole field, a slice along each axis and a box across brick borders
+            const VTKRegion boxes[] = {
+                { {0, 0, 0}, dim },
+                { {0, 0, 17}, {dim.x, dim.y, 2} },
+                { {0, 31, 0}, {dim.x, 2, dim.z} },
+                { {64, 0, 0}, {2, dim.y, dim.z} },
+                { {30, 5, 3}, {10, 30, 31} },
+            };
+            for (const VTKRegion& box : boxes) {
+                const VTKField<float> samples = bricked.read_box(box.begin, box.size);
+                bool same = true;
+                for (int z = 0; same && z < box.size.z; z++) {
+                    for (int y = 0; same && y < box.size.y; y++) {
+                        for (int x = 0; same && x < box.size.x; x++) {
+                            same = samples(x, y, z) == field(box.begin.x + x, box.begin.y + y, box.begin.z + z);
+                        }
+                    }
+                }
+                check(same, "bricked: samples of a box");
+            }
+            check(bricked.resident_bytes() <= 3 * BRICK_VALUES * sizeof(float), "bricked: resident bricks stay within the budget");
+        } catch (const std::exception& e) {
+            check(false, std::string("bricked: ") + e.what());
+        }
+        fs::remove(path);
+        if (!bricks.empty()) {
+            fs::remove(bricks);
+        }
+    }
+
+    // A field still opens out of core once a default load has written the
+    // field cache for its file
+    {
+        const fs::path path = fs::temp_directory_path() / "sfv_check_bricked_cache.vtk";
+        {
+            std::ofstream out(path, std::ios::binary);
+            out << "# vtk DataFile Version 3.0\nbricked cache\nASCII\nDATASET STRUCTURED_POINTS\n"
+                << "DIMENSIONS 4 4 4\nORIGIN 0 0 0\nSPACING 1 1 1\nPOINT_DATA 64\nFIELD FieldData 1\n"
+                << "samples 1 64 float\n";
+            for (int i = 0; i < 64; i++) {
+                out << i << (i % 8 == 7 ? "\n" : " ");
+            }
+        }
+        for (int pass = 0; pass < 2; pass++) {
+            const std::string what = pass == 0 ? "bricked before a cache: " : "bricked after a cache: ";
+            try {
+                VTKData index = open_index(path);
+                const auto bricked = std::get<BrickedField<float>>(open_bricked(index, 0, BRICK_VALUES * sizeof(float)));
+                const VTKField<float> samples = bricked.read_box({0, 0, 0}, {4, 4, 4});
+                bool same = true;
+                for (size_t i = 0; same && i < 64; i++) {
+                    same = samples.data[i] == float(i);
+                }
+                check(same, what + "samples");
+                fs::remove(BrickedField<float>::path_for(path, 0));
+            } catch (const std::exception& e) {
+                check(false, what + e.what());
+            }
+            if (pass == 0) {
+                VTKParser::from_file(path);
+                check(fs::exists(VTKCache::path_for(path)), "bricked cache: a default load writes the cache");
+            }
+        }
+        fs::remove(path);
+        fs::remove(VTKCache::path_for(path));
+    }
+
+    // A .vti file loads the same grid as the legacy file it was written from,
+    // in every encoding, byte order and block size header width the reader takes
+    {
+        const Dimension dim = {5, 4, 3};
+        const int count = dim.x * dim.y * dim.z;
+        std::vector<float> density(count);
+        std::vector<short> label(count);
+        std::vector<double> energy(count);
+        std::vector<float> velocity(3 * count);
+        for (int i = 0; i < count; i++) {
+            density[i] = i * 0.25f - 3.0f;
+            label[i] = short(i * 7 - 100);
+            energy[i] = i / 3.0 + 1e-3;
+            velocity[3 * i] = velocity[3 * i + 1] = velocity[3 * i + 2] = float(i);
+        }
+
+        // The legacy file's origin is the first point of the .vti file's extent
+        const fs::path legacy_path = fs::temp_directory_path() / "sfv_check_vti.vtk";
+        {
+            std::ofstream out(legacy_path, std::ios::binary);
+            out.precision(17);
+            out << "# vtk DataFile Version 3.0\nvti\nASCII\nDATASET STRUCTURED_POINTS\n"
+                << "DIMENSIONS " << dim.x << " " << dim.y << " " << dim.z << "\nORIGIN 1.5 -2 0.5\nSPACING 0.5 0.25 2\n"
+                << "POINT_DATA " << count << "\nFIELD FieldData 3\n";
+            out << "density 1 " << count << " float\n";
+            for (float v : density) out << v << "\n";
+            out << "label 1 " << count << " short\n";
+            for (short v : label) out << v << "\n";
+            out << "energy 1 " << count << " double\n";
+            for (double v : energy) out << v << "\n";
+        }
+
+        auto base64 = [](const std::string& bytes) {
+            const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            std::string text;
+            for (size_t i = 0; i < bytes.size(); i += 3) {
+                uint32_t bits = 0;
+                for (size_t j = 0; j < 3; j++) {
+                    bits = bits << 8 | (i + j < bytes.size() ? uint8_t(bytes[i + j]) : 0);
+                }
+                const size_t n = std::min<size_t>(3, bytes.size() - i);
+                for (size_t j = 0; j < 4; j++) {
+                    text += j <= n ? alphabet[(bits >> (18 - 6 * j)) & 63] : '=';
+                }
+            }
+            return text;
+        };
+
+        enum class Layout { Ascii, Base64, AppendedRaw, AppendedBase64 };
+        const char* layout_names[] = {"ascii", "base64", "appended raw", "appended base64"};
+        for (Layout layout : {Layout::Ascii, Layout::Base64, Layout::AppendedRaw, Layout::AppendedBase64}) {
+            for (bool big_endian : {false, true}) {
+                for (size_t header_width : {4, 8}) {
+                    if (layout == Layout::Ascii && (big_endian || header_width == 8)) {
+                        // Text has neither
+                        continue;
+                    }
+                    for (int streams = 1; streams <= (layout == Layout::Base64 || layout == Layout::AppendedBase64 ? 2 : 1); streams++) {
+                        // An array as VTK writes it: the byte count in a block
+                        // size header, then the samples
+                        auto encode = [&](const auto& values) {
+                            using T = typename std::decay_t<decltype(values)>::value_type;
+                            std::string header;
+                            if (header_width == 8) {
+                                header = bytes_of(std::vector<uint64_t>{values.size() * sizeof(T)}, big_endian);
+                            } else {
+                                header = bytes_of(std::vector<uint32_t>{uint32_t(values.size() * sizeof(T))}, big_endian);
+                            }
+                            if (layout == Layout::AppendedRaw) {
+                                return header + bytes_of(values, big_endian);
+                            }
+                            return streams == 1 ? base64(header + bytes_of(values, big_endian))
+                                                : base64(header) + base64(bytes_of(values, big_endian));
+                        };
+
+                        std::string appended;
+                        auto array = [&](const char* type, const char* name, int components, const auto& values) {
+                            std::ostringstream tag;
+                            tag.precision(17);
+                            tag << "<DataArray type=\"" << type << "\" Name=\"" << name << "\" NumberOfComponents=\"" << components << "\"";
+                            if (layout == Layout::Ascii) {
+                                tag << " format=\"ascii\">\n";
+                                for (size_t i = 0; i < values.size(); i++) {
+                                    tag << +values[i] << (i % 6 == 5 ? "\n" : " ");
+                                }
+                                tag << "\n</DataArray>\n";
+                            } else if (layout == Layout::Base64) {
+                                tag << " format=\"binary\">\n" << encode(values) << "\n</DataArray>\n";
+                            } else {
+                                tag << " format=\"appended\" offset=\"" << appended.size() << "\"/>\n";
+                                appended += encode(values);
+                            }
+                            return tag.str();
+                        };
+
+                        std::ostringstream vti;
+                        vti << "<?xml version=\"1.0\"?>\n<VTKFile type=\"ImageData\" version=\"1.0\" byte_order=\""
+                            << (big_endian ? "BigEndian" : "LittleEndian") << "\" header_type=\"" << (header_width == 8 ? "UInt64" : "UInt32") << "\">\n"
+                            << "<ImageData WholeExtent=\"2 6 -4 -1 0 2\" Origin=\"0.5 -1 0.5\" Spacing=\"0.5 0.25 2\">\n"
+                            << "<Piece Extent=\"2 6 -4 -1 0 2\">\n<PointData Scalars=\"density\">\n"
+                            << array("Float32", "density", 1, density)
+                            << array("Float32", "velocity", 3, velocity)
+                            << array("Int16", "label", 1, label)
+                            << array("Float64", "energy", 1, energy)
+                            << "</PointData>\n</Piece>\n</ImageData>\n";
+                        if (!appended.empty()) {
+                            vti << "<AppendedData encoding=\"" << (layout == Layout::AppendedRaw ? "raw" : "base64") << "\">\n_"
+                                << appended << "\n</AppendedData>\n";
+                        }
+                        vti << "</VTKFile>\n";
+
+                        const std::string what = std::string("vti ") + layout_names[int(layout)] + (big_endian ? ", big endian" : ", little endian")
+                            + (header_width == 8 ? ", UInt64" : ", UInt32") + (streams == 2 ? ", two streams" : "") + ": ";
+                        const fs::path path = fs::temp_directory_path() / "sfv_check.vti";
+                        std::ofstream(path, std::ios::binary) << vti.str();
+                        try {
+                            VTKData legacy = VTKParser::from_file(legacy_path, options);
+                            VTKData data = VTKParser::from_file(path, options);
+                            check(data.dimension.x == dim.x && data.dimension.y == dim.y && data.dimension.z == dim.z, what + "dimensions");
+                            check(data.origin.x == legacy.origin.x && data.origin.y == legacy.origin.y && data.origin.z == legacy.origin.z, what + "origin");
+                            check(data.spacing.x == legacy.spacing.x && data.spacing.y == legacy.spacing.y && data.spacing.z == legacy.spacing.z, what + "spacing");
+                            check(data.fields.size() == legacy.fields.size(), what + "the vector array is skipped");
+                            for (size_t f = 0; f < std::min(data.fields.size(), legacy.fields.size()); f++) {
+                                const bool same = std::visit([](const auto& a, const auto& b) {
+                                    if constexpr (std::is_same_v<decltype(a), decltype(b)>) {
+                                        return a.name == b.name && a.data.size() == b.data.size()
+                                            && std::equal(a.data.begin(), a.data.end(), b.data.begin());
+                                    } else {
+                                        return false;
+                                    }
+                                }, data.fields[f], legacy.fields[f]);
+                                check(same, what + "samples of " + legacy.field_index[f].name);
+                            }
+                        } catch (const std::exception& e) {
+                            check(false, what + e.what());
+                        }
+                        fs::remove(path);
+                    }
+                }
+            }
+        }
+        fs::remove(legacy_path);
+    }
+
+    // Every stride and region picks the same samples out of an ASCII file, a
+    // binary file and the cache in each codec as out of a full load of it
+    {
+        const Dimension dim = {61, 47, 53};
+        const int count = dim.x * dim.y * dim.z;
+        std::vector<float> wave(count);
+        std::vector<short> steps(count);
+        for (int i = 0; i < count; i++) {
+            wave[i] = float(100.0 * std::sin(0.001 * i) + 3.0 * std::cos(0.37 * i));
+            steps[i] = short((i * 31) % 2000 - 1000);
+        }
+
+        const fs::path ascii_path = fs::temp_directory_path() / "sfv_check_subgrid_ascii.vtk";
+        const fs::path binary_path = fs::temp_directory_path() / "sfv_check_subgrid_binary.vtk";
+        for (bool binary : {false, true}) {
+            std::ofstream out(binary ? binary_path : ascii_path, std::ios::binary);
+            out.precision(9);
+            out << "# vtk DataFile Version 3.0\nsubgrid\n" << (binary ? "BINARY" : "ASCII") << "\nDATASET STRUCTURED_POINTS\n"
+                << "DIMENSIONS " << dim.x << " " << dim.y << " " << dim.z << "\nORIGIN 1 2 3\nSPACING 0.5 1 2\n"
+                << "POINT_DATA " << count << "\nFIELD FieldData 2\n";
+            out << "wave 1 " << count << " float\n";
+            if (binary) {
+                out << bytes_of(wave, true) << "\n";
+            } else {
+                for (int i = 0; i < count; i++) out << wave[i] << (i % 9 == 8 ? "\n" : " ");
+                out << "\n";
+            }
+            out << "steps 1 " << count << " short\n";
+            if (binary) {
+                out << bytes_of(steps, true) << "\n";
+            } else {
+                for (int i = 0; i < count; i++) out << steps[i] << (i % 9 == 8 ? "\n" : " ");
+                out << "\n";
+            }
+        }
+
+        // Whole grid, a box off every border, a row, a column along z, one
+        // point and a box ending at the far corner
+        const std::optional<VTKRegion> regions[] = {
+            std::nullopt,
+            VTKRegion { {0, 0, 0}, dim },
+            VTKRegion { {5, 3, 2}, {40, 30, 45} },
+            VTKRegion { {0, 20, 30}, {dim.x, 1, 1} },
+            VTKRegion { {dim.x - 1, dim.y - 1, 0}, {1, 1, dim.z} },
+            VTKRegion { {17, 9, 41}, {1, 1, 1} },
+            VTKRegion { {30, 20, 10}, {dim.x - 30, dim.y - 20, dim.z - 10} },
+        };
+        const int strides[] = {1, 2, 3, 7};
+
+        // Whether `part` holds every stride-th sample of `region` of `whole`
+        auto same_gather = [](const VTKData& part, const VTKData& whole, int stride, const VTKRegion& region) {
+            const Dimension expected = { (region.size.x - 1) / stride + 1, (region.size.y - 1) / stride + 1, (region.size.z - 1) / stride + 1 };
+            bool same = part.fields.size() == whole.fields.size()
+                && part.dimension.x == expected.x && part.dimension.y == expected.y && part.dimension.z == expected.z
+                && part.origin.x == whole.origin.x + region.begin.x * whole.spacing.x
+                && part.origin.y == whole.origin.y + region.begin.y * whole.spacing.y
+                && part.origin.z == whole.origin.z + region.begin.z * whole.spacing.z
+                && part.spacing.x == whole.spacing.x * stride
+                && part.spacing.y == whole.spacing.y * stride
+                && part.spacing.z == whole.spacing.z * stride;
+            for (size_t f = 0; same && f < part.fields.size(); f++) {
+                same = std::visit([&](const auto& a, const auto& b) {
+                    if constexpr (std::is_same_v<decltype(a), decltype(b)>) {
+                        auto lo = b(region.begin.x, region.begin.y, region.begin.z);
+                        auto hi = lo;
+                        for (int z = 0; z < expected.z; z++) {
+                            for (int y = 0; y < expected.y; y++) {
+                                for (int x = 0; x < expected.x; x++) {
+                                    const auto v = b(region.begin.x + x * stride, region.begin.y + y * stride, region.begin.z + z * stride);
+                                    if (a(x, y, z) != v) {
+                                        return false;
+                                    }
+                                    lo = std::min(lo, v);
+                                    hi = std::max(hi, v);
+                                }
+                            }
+                        }
+                        return a.min == lo && a.max == hi;
+                    } else {
+                        return false;
+                    }
+                }, part.fields[f], whole.fields[f]);
+            }
+            return same;
+        };
+
+        const char* source_names[] = {"ascii", "binary", "raw cache", "lossless cache", "lossy cache"};
+        for (int source = 0; source < 5; source++) {
+            const fs::path& path = source == 0 ? ascii_path : binary_path;
+            VTKParseOptions full = options;
+            if (source >= 2) {
+                full.cache = true;
+                full.cache_codec = source == 2 ? VTKCacheCodec::Raw : source == 3 ? VTKCacheCodec::Lossless : VTKCacheCodec::Lossy;
+                full.cache_error_bound = source == 4 ? 0.01 : 0.0;
+                fs::remove(VTKCache::path_for(path));
+            }
+            // A cache's samples are compared with a full load of the same
+            // cache, so the lossy codec is held to the same exact gather
+            auto load = [&](const VTKParseOptions& o) {
+                if (source < 2) {
+                    return VTKParser::from_file(path, o);
+                }
+                std::optional<VTKData> cached = VTKCache::load(path, o);
+                if (!cached) {
+                    throw std::runtime_error("no usable cache");
+                }
+                return std::move(*cached);
+            };
+            const std::string what = std::string("subgrid from ") + source_names[source] + ": ";
+            try {
+                if (source >= 2) {
+                    VTKParser::from_file(path, full);
+                }
+                const VTKData whole = load(full);
+                for (size_t r = 0; r < std::size(regions); r++) {
+                    const auto& region = regions[r];
+                    for (int stride : strides) {
+                        VTKParseOptions part = full;
+                        part.stride = stride;
+                        part.region = region;
+                        check(same_gather(load(part), whole, stride, region.value_or(VTKRegion { {0, 0, 0}, dim })),
+                              what + "region " + std::to_string(r) + ", stride " + std::to_string(stride));
+                    }
+                }
+            } catch (const std::exception& e) {
+                check(false, what + e.what());
+            }
+            fs::remove(VTKCache::path_for(path));
+        }
+        fs::remove(ascii_path);
+        fs::remove(binary_path);
+    }
+
+    // A field cache in each codec reopens with the samples and ranges it was
+    // written from, and is passed over once the source or the codec changes
+    {
+        const Dimension dim = {40, 40, 50};
+        const int count = dim.x * dim.y * dim.z;
+        std::vector<double> smooth(count);
+        std::vector<float> noisy(count);
+        std::vector<short> ids(count);
+        std::vector<unsigned char> mask(count);
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> uniform(-50.0f, 50.0f);
+        for (int i = 0; i < count; i++) {
+            smooth[i] = std::sin(0.002 * i) * 1e3;
+            noisy[i] = uniform(random);
+            ids[i] = short(i % 3000 - 1500);
+            mask[i] = (unsigned char)(i % 7 == 0 ? 255 : i % 5);
+        }
+
+        const fs::path path = fs::temp_directory_path() / "sfv_check_cache.vtk";
+        {
+            std::ofstream out(path, std::ios::binary);
+            out << "# vtk DataFile Version 3.0\ncache\nBINARY\nDATASET STRUCTURED_POINTS\n"
+                << "DIMENSIONS " << dim.x << " " << dim.y << " " << dim.z << "\nORIGIN 0 0 0\nSPACING 1 1 1\n"
+                << "POINT_DATA " << count << "\nFIELD FieldData 4\n"
+                << "smooth 1 " << count << " double\n" << bytes_of(smooth, true) << "\n"
+                << "noisy 1 " << count << " float\n" << bytes_of(noisy, true) << "\n"
+                << "ids 1 " << count << " short\n" << bytes_of(ids, true) << "\n"
+                << "mask 1 " << count << " unsigned_char\n" << bytes_of(mask, true) << "\n";
+        }
+        const fs::path cache_path = VTKCache::path_for(path);
+
+        const VTKCacheCodec codecs[] = {VTKCacheCodec::Raw, VTKCacheCodec::Lossless, VTKCacheCodec::Lossy};
+        const char* codec_names[] = {"raw", "lossless", "lossy"};
+        const double error_bound = 0.05;
+        try {
+            const VTKData parsed = VTKParser::from_file(path, options);
+            for (int c = 0; c < 3; c++) {
+                const std::string what = std::string("cache ") + codec_names[c] + ": ";
+                VTKParseOptions cached_options = options;
+                cached_options.cache = true;
+                cached_options.cache_codec = codecs[c];
+                cached_options.cache_error_bound = codecs[c] == VTKCacheCodec::Lossy ? error_bound : 0.0;
+
+                fs::remove(cache_path);
+                VTKParser::from_file(path, cached_options);
+                const std::optional<VTKData> cached = VTKCache::load(path, cached_options);
+                check(cached.has_value(), what + "a full load writes the cache");
+                if (!cached) {
+                    continue;
+                }
+
+                check(cached->fields.size() == parsed.fields.size(), what + "every field is cached");
+                for (size_t f = 0; f < std::min(cached->fields.size(), parsed.fields.size()); f++) {
+                    const double tolerance = codecs[c] == VTKCacheCodec::Lossy ? error_bound : 0.0;
+                    const bool same = std::visit([&](const auto& a, const auto& b) {
+                        if constexpr (std::is_same_v<decltype(a), decltype(b)>) {
+                            if (a.data.size() != b.data.size() || a.min != b.min || a.max != b.max) {
+                                return false;
+                            }
+                            for (size_t i = 0; i < a.data.size(); i++) {
+                                if (tolerance == 0.0 ? a.data[i] != b.data[i] : std::abs(double(a.data[i]) - double(b.data[i])) > tolerance) {
+                                    return false;
+                                }
+                            }
+                            return true;
+                        } else {
+                            return false;
+                        }
+                    }, cached->fields[f], parsed.fields[f]);
+                    check(same, what + "samples and range of " + parsed.field_index[f].name);
+                }
+
+                // Any other codec, or another error bound, has the file parsed again
+                for (int other = 0; other < 3; other++) {
+                    VTKParseOptions other_options = cached_options;
+                    other_options.cache_codec = codecs[other];
+                    other_options.cache_error_bound = codecs[other] == VTKCacheCodec::Lossy ? error_bound : 0.0;
+                    if (other == c) {
+                        if (codecs[c] != VTKCacheCodec::Lossy) {
+                            continue;
+                        }
+                        other_options.cache_error_bound = 2 * error_bound;
+                    }
+                    check(!VTKCache::load(path, other_options), what + "not used with the " + codec_names[other] + " codec");
+                }
+            }
+
+            // New samples of the same size, written later, replace the cached ones
+            {
+                VTKParseOptions cached_options = options;
+                cached_options.cache = true;
+                fs::remove(cache_path);
+                VTKParser::from_file(path, cached_options);
+
+                noisy[0] = 1234.5f;
+                std::string text;
+                {
+                    std::ifstream in(path, std::ios::binary);
+                    text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                }
+                const std::string noisy_header = "noisy 1 " + std::to_string(count) + " float\n";
+                const size_t at = text.find(noisy_header) + noisy_header.size();
+                text.replace(at, sizeof(float), bytes_of(std::vector<float>{noisy[0]}, true));
+                const auto written = fs::last_write_time(path);
+                std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+                fs::last_write_time(path, written + std::chrono::seconds(2));
+
+                check(!VTKCache::load(path, cached_options), "cache: not used once the source changes");
+                const VTKData reparsed = VTKParser::from_file(path, cached_options);
+                check(std::get<VTKField<float>>(reparsed.fields[1]).data[0] == noisy[0], "cache: a changed source is parsed again");
+                check(VTKCache::load(path, cached_options).has_value(), "cache: a changed source is cached again");
+            }
+        } catch (const std::exception& e) {
+            check(false, std::string("cache: ") + e.what());
+        }
+        fs::remove(path);
+        fs::remove(cache_path);
+    }
+
+    // Percentiles match a sorted copy of the samples, even with one outlier
+    // stretching the histogram's range a hundred thousand times
+    {
+        std::mt19937 random(1);
+        std::normal_distribution<float> normal(5.0f, 2.0f);
+        std::vector<float> samples(1000000);
+        for (float& v : samples) {
+            v = normal(random);
+        }
+        samples.push_back(1e6f);
+        const auto range = std::minmax_element(samples.begin(), samples.end());
+        const VTKFieldStats stats = compute_stats(samples.data(), samples.size(), *range.first, *range.second);
+
+        std::vector<float> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        auto nearest_rank = [&](double p) {
+            size_t rank = size_t(std::ceil(p * sorted.size()));
+            return double(sorted[std::clamp(rank, size_t(1), sorted.size()) - 1]);
+        };
+        check(stats.p01 == nearest_rank(0.01), "percentiles: 1st percentile with an outlier");
+        check(stats.p99 == nearest_rank(0.99), "percentiles: 99th percentile with an outlier");
+    }
+
+    std::cout << (failures == 0 ? "All checks passed\n" : "Some checks failed\n");
+    return failures;
+}
 
 int main(int argc, char** argv) {
-    auto data = VTKParser::from_file("data/redseasmall.vtk");
+    fs::path path = "data/redseasmall.vtk";
+    VTKParseOptions options;
+    bool codec = false;
+    double error_bound = 0.0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--check") == 0) {
+            return run_checks() == 0 ? 0 : 1;
+        } else if (std::strcmp(argv[i], "--no-cache") == 0) {
+            // Measure the parser even if a cache exists for the file
+            options.cache = false;
+        } else if (std::strcmp(argv[i], "--codec") == 0) {
+            // Benchmark the cache codec; lossy if followed by an error bound
+            codec = true;
+            if (i + 1 < argc && std::isdigit(argv[i + 1][0])) {
+                error_bound = std::atof(argv[++i]);
+            }
+        } else {
+            path = argv[i];
+        }
+    }
+
+    auto start = Clock::now();
+    auto data = VTKParser::from_file(path, options);
+    double seconds = seconds_since(start);
+
+    double megabytes = fs::file_size(path) / (1024.0 * 1024.0);
+    std::cout << "Parsed " << path << " (" << megabytes << " MB, "
+        << data.fields.size() << " fields) in " << seconds << " s: "
+        << megabytes / seconds << " MB/s\n";
+
+    if (codec) {
+        std::cout << (error_bound > 0 ? "Lossy" : "Lossless") << " codec, error bound " << error_bound << "\n";
+        for (auto& field : data.fields) {
+            std::visit([&](const auto& f) { bench_codec(f, error_bound); }, field);
+        }
+    }
     return 0;
 }